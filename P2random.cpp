@@ -7,21 +7,12 @@ void P2random::PR_init(std::stringstream& ss,
                        uint32_t seed,
                        uint32_t max_rubble,
                        uint32_t tnt) {
-    P2random::MersenneTwister mt;
-    mt.init_genrand(seed);
-
-	for (uint32_t row = 0; row < size; ++row) {
-		for (uint32_t col = 0; col < size; ++col) {
-			if (tnt != 0 && mt.genrand_unsigned_int() % tnt == 0)
-				ss << -1;
-			else
-				ss << mt.genrand_unsigned_int() % max_rubble;
-
-			if (col < size - 1)
-				ss << " ";
-		}  // for col
-		ss << '\n';
-	}  // for row
+	// The same values PR_generate makes, written out as text
+	PR_generate(size, seed, max_rubble, tnt, [&ss, size](uint32_t, uint32_t col, int value) {
+		ss << value;
+		ss << (col < size - 1 ? ' ' : '\n');
+		return true;
+	});
 }
 
 
@@ -75,16 +66,23 @@ void P2random::PR_init(std::stringstream& ss,
 // Constructor
 //
 P2random::MersenneTwister::MersenneTwister(void):
-    mt_(new uint32_t[N]), mti_(N + 1) {
+    mti_(N + 1) {
     init_genrand(0);
 }  // constructor
 
+//
+// Constructor that seeds the state once, instead of seeding it with 0
+// and then again with init_genrand(s)
+//
+P2random::MersenneTwister::MersenneTwister(uint32_t s):
+    mti_(N + 1) {
+    init_genrand(s);
+}  // constructor
+
 //
 // Destructor
 //
 P2random::MersenneTwister::~MersenneTwister(void) {
-    delete [] mt_;
-    mt_ = NULL;
 }  // destructor
 
 //
@@ -17,10 +17,23 @@ public:
                         uint32_t max_rubble,
                         uint32_t tnt);
 
+    // Makes the same mine as PR_init, but hands every value straight to
+    // setTile(row, col, value) instead of writing it out as text. Stops
+    // early if setTile returns false
+    template <typename SetTile>
+    static void PR_generate(uint32_t size,
+                            uint32_t seed,
+                            uint32_t max_rubble,
+                            uint32_t tnt,
+                            SetTile setTile);
+
     // No need to read further than this, unless you want to learn about
     // Mersenne Twister implementation
 
 private:
+    // The microbenchmarks time the generator on its own
+    friend struct MineBench;
+
     //
     // mt.h: Mersenne Twister header file
     //
@@ -42,6 +55,7 @@ private:
     {
     public:
         MersenneTwister(void);
+        explicit MersenneTwister(uint32_t s);
         ~MersenneTwister(void);
 
         // The copy constructor and operator=() should never be used.
@@ -62,11 +76,34 @@ private:
         // least significant r bits
         static const uint32_t LOWER_MASK = 0x7fffffffU;
 
-        uint32_t *mt_;  // the state vector
+        uint32_t mt_[N];  // the state vector, inline so a generator on the
+                          // stack never allocates
         uint32_t mti_;  // mti == N+1 means mt not initialized
     };
 
     static MersenneTwister mt;
 };
 
+template <typename SetTile>
+void P2random::PR_generate(uint32_t size,
+                           uint32_t seed,
+                           uint32_t max_rubble,
+                           uint32_t tnt,
+                           SetTile setTile) {
+    P2random::MersenneTwister mt(seed);
+
+    for (uint32_t row = 0; row < size; ++row) {
+        for (uint32_t col = 0; col < size; ++col) {
+            int value;
+            if (tnt != 0 && mt.genrand_unsigned_int() % tnt == 0)
+                value = -1;
+            else
+                value = static_cast<int>(mt.genrand_unsigned_int() % max_rubble);
+
+            if (!setTile(row, col, value))
+                return;
+        }  // for col
+    }  // for row
+}  // PR_generate()
+
 #endif  // P2RANDOM_H
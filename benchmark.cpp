@@ -0,0 +1,198 @@
+// Project Identifier: 19034C8F3B1196BF8E0C6E1C0F973D2FD550B88F
+// Microbenchmarks for the pieces of mineEscape, built with "make bench". Every workload is made from
+// fixed seeds so two builds can be compared run for run
+#include "mineEscape.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+#include "P2random.h"
+
+
+struct MineBench {
+    size_t repetitions = 20;
+    vector<string> names;
+
+    // Runs setup then times work, over and over after one warm up run. Prints the nearest-rank
+    // percentiles in milliseconds so they are always one of the actual times
+    void time(const string& name, const function<void()>& setup, const function<void()>& work) {
+        if (!names.empty() && std::find(names.begin(), names.end(), name) == names.end()) {
+            return;
+        }
+        vector<double> results;
+        for (size_t run = 0; run <= repetitions; ++run) {
+            setup();
+            auto start = std::chrono::steady_clock::now();
+            work();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            if (run > 0) {
+                results.push_back(elapsed.count());
+            }
+        }
+
+        std::sort(results.begin(), results.end());
+        auto percentile = [&](size_t percent) {
+            return results[std::max<size_t>(1, (percent * results.size() + 99) / 100) - 1];
+        };
+        cout << std::left << std::setw(16) << name << std::right << std::setw(6) << results.size() << std::fixed
+             << std::setprecision(3) << std::setw(12) << results.front() << std::setw(12) << percentile(50)
+             << std::setw(12) << percentile(90) << std::setw(12) << results.back() << endl;
+    }
+
+    // Mines a pseudorandom board with a recording queue and hands back everything done to the queue
+    static vector<uint64_t> recordQueue(uint32_t size, uint32_t seed, uint32_t maxRubble, uint32_t tntChance) {
+        MineBoard game;
+        game.size = size;
+        game.currRow = size / 2;
+        game.currCol = size / 2;
+        game.map2D.assign(size, size);
+        game.generateRows(seed, maxRubble, tntChance);
+        if (game.numTNT > 0) {
+            game.findTNTComponents();
+        }
+
+        vector<uint64_t> operations;
+        RecordingQueue queue(operations);
+        queue.reset(size);
+        game.startMining();
+        MineEvent event;
+        while (game.nextEventWith(game.map2D, queue, event)) {
+        }
+        game.finishLoading();
+        return operations;
+    }
+
+    void run() {
+        cout << std::left << std::setw(16) << "benchmark" << std::right << std::setw(6) << "runs" << std::setw(12)
+             << "min ms" << std::setw(12) << "p50 ms" << std::setw(12) << "p90 ms" << std::setw(12) << "max ms"
+             << endl;
+
+        // The queue as it is used in a real run, with TNT moving tiles that are already queued
+        const uint32_t queueSize = 300;
+        vector<uint64_t> operations = recordQueue(queueSize, 281, 100, 8);
+        TileQueue tileQueue;
+        time("tile-queue", [&] { tileQueue.reset(queueSize); },
+             [&] {
+                 for (uint64_t operation : operations) {
+                     if (operation == RecordingQueue::POP) {
+                         tileQueue.pop();
+                     } else if (operation & RecordingQueue::UPDATE) {
+                         tileQueue.update(operation & ~RecordingQueue::UPDATE);
+                     } else {
+                         tileQueue.push(operation);
+                     }
+                 }
+             });
+
+        // The same pattern on the priority_queue of tile pointers that TileQueue replaced, where a tile
+        // TNT clears gets moved by popping everything above it and pushing it all back (sortQueue)
+        vector<Tile> tiles(queueSize * queueSize);
+        auto tileFor = [&](uint64_t key) -> Tile& {
+            return tiles[TileQueue::row(key) * queueSize + TileQueue::col(key)];
+        };
+        priority_queue<Tile*, vector<Tile*>, TileCompare> tilePQ;
+        time("tile-compare", [&] { tilePQ = priority_queue<Tile*, vector<Tile*>, TileCompare>(); },
+             [&] {
+                 for (uint64_t operation : operations) {
+                     if (operation == RecordingQueue::POP) {
+                         tilePQ.pop();
+                     } else if (operation & RecordingQueue::UPDATE) {
+                         Tile& tile = tileFor(operation);
+                         tile.rubble = static_cast<int>((operation & ~RecordingQueue::UPDATE) >> 32) - 1;
+                         vector<Tile*> popped;
+                         while (!tilePQ.empty()) {
+                             popped.push_back(tilePQ.top());
+                             tilePQ.pop();
+                             if (popped.back() == &tile) {
+                                 break;
+                             }
+                         }
+                         for (Tile* poppedTile : popped) {
+                             tilePQ.push(poppedTile);
+                         }
+                     } else {
+                         Tile& tile = tileFor(operation);
+                         tile = Tile { TileQueue::row(operation), TileQueue::col(operation),
+                                       static_cast<int>(operation >> 32) - 1 };
+                         tilePQ.push(&tile);
+                     }
+                 }
+             });
+
+        // Median mode, which asks for the median after every tile
+        MineBoard medianGame;
+        std::mt19937 medianValues(281);
+        time("get-median",
+             [&] {
+                 medianValues.seed(281);
+                 medianGame.rubbleValues.clear();
+                 medianGame.tilesCleared = 0;
+             },
+             [&] {
+                 for (size_t i = 0; i < 5000; ++i) {
+                     medianGame.rubbleValues.push_back(static_cast<int>(medianValues() % 100) + 1);
+                     medianGame.tilesCleared++;
+                     medianGame.getMedian();
+                 }
+             });
+
+        P2random::MersenneTwister twister;
+        volatile uint32_t sink = 0;
+        time("genrand", [&] { twister.init_genrand(281); },
+             [&] {
+                 uint32_t sum = 0;
+                 for (size_t i = 0; i < 10000000; ++i) {
+                     sum += twister.genrand_unsigned_int();
+                 }
+                 sink = sum;
+             });
+
+        std::stringstream generated;
+        time("pr-init", [&] { generated.str(""); }, [&] { P2random::PR_init(generated, 1000, 281, 100, 8); });
+
+        // A 2000x2000 hand-written mine, parsed from memory so the disk doesn't get timed
+        std::stringstream mineText;
+        mineText << "M\nSize: 2000\nStart: 1000 1000\n";
+        P2random::PR_init(mineText, 2000, 281, 100, 8);
+        string inputText = mineText.str();
+        MineBoard parseGame;
+        stringbuf input;
+        stringbuf discard;
+        time("read-input", [&] { input.str(inputText); parseGame.reset(&input, &discard); },
+             [&] { parseGame.readInput(); });
+    }
+};
+
+int main(int argc, char* argv[]) {
+    ios_base::sync_with_stdio(false);
+
+    MineBench bench;
+    int choice;
+    while ((choice = getopt(argc, argv, "hr:")) != -1) {
+        switch (choice) {
+        case 'r':
+            bench.repetitions = static_cast<size_t>(std::max(1, std::stoi(optarg)));
+            break;
+
+        default:
+            cerr << "Usage: " << argv[0] << " [-r <repetitions>] [benchmark...]\n";
+            cerr << "Benchmarks: tile-queue tile-compare get-median genrand pr-init read-input\n";
+            return choice == 'h' ? 0 : 1;
+        }
+    }
+    for (int i = optind; i < argc; ++i) {
+        bench.names.push_back(argv[i]);
+    }
+
+    bench.run();
+    return 0;
+}
@@ -2,76 +2,975 @@
 #include "mineEscape.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <chrono>
+#include <climits>
 #include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <deque>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <new>
 #include <queue>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
+#include <dlfcn.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <linux/mempolicy.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <zlib.h>
 
 #include "P2random.h"
 
 
+// Huge pages are 2 MiB, anything smaller than one just comes from new
+static constexpr size_t HUGE_PAGE_BYTES = size_t(2) << 20;
+
+atomic<int> BoardMemory::numaPolicy { BoardMemory::NUMA_DEFAULT };
+
+void BoardMemory::setNumaPolicy(NumaPolicy policy) {
+    numaPolicy.store(policy, std::memory_order_relaxed);
+}
+
+// Bit mask of the NUMA nodes that are online, from a list like "0-1,3". Zero if it can't be read
+static unsigned long onlineNodes() {
+    ifstream nodeList("/sys/devices/system/node/online");
+    unsigned long nodes = 0;
+    for (string range; std::getline(nodeList, range, ',');) {
+        unsigned first = 0;
+        unsigned last = 0;
+        char dash = '\0';
+        istringstream rangeStream(range);
+        if (!(rangeStream >> first)) {
+            return 0;
+        }
+        last = (rangeStream >> dash >> last) ? last : first;
+        for (unsigned node = first; node <= last && node < sizeof(nodes) * CHAR_BIT; ++node) {
+            nodes |= 1UL << node;
+        }
+    }
+    return nodes;
+}
+
+void* BoardMemory::allocate(size_t bytes) {
+    if (bytes < HUGE_PAGE_BYTES) {
+        return ::operator new(bytes);
+    }
+    size_t length = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+
+    // Reserved huge pages if there are enough, otherwise normal pages the kernel is asked to back with
+    // transparent huge pages
+    void* memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory == MAP_FAILED) {
+        memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        madvise(memory, length, MADV_HUGEPAGE);
+    }
+
+    // Nothing has been touched yet so the policy decides where every page ends up. If the kernel
+    // says no the memory just stays wherever it would have gone anyway
+    int policy = numaPolicy.load(std::memory_order_relaxed);
+    unsigned long nodes = 0;
+    if (policy == NUMA_INTERLEAVE) {
+        nodes = onlineNodes();
+    } else if (policy == NUMA_LOCAL) {
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 && node < sizeof(nodes) * CHAR_BIT) {
+            nodes = 1UL << node;
+        }
+    }
+    if (nodes != 0) {
+        syscall(SYS_mbind, memory, length, policy == NUMA_INTERLEAVE ? MPOL_INTERLEAVE : MPOL_PREFERRED, &nodes,
+                sizeof(nodes) * CHAR_BIT + 1, 0);
+    }
+    return memory;
+}
+
+void BoardMemory::deallocate(void* memory, size_t bytes) {
+    if (bytes < HUGE_PAGE_BYTES) {
+        ::operator delete(memory);
+        return;
+    }
+    munmap(memory, (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES);
+}
+
+
+// FNV-1a over whole values instead of bytes, good enough to tell mines apart in the cache
+static constexpr uint64_t FNV_OFFSET = 14695981039346656037ULL;
+
+static uint64_t mixHash(uint64_t hash, uint64_t value) {
+    return (hash ^ value) * 1099511628211ULL;
+}
+
+// Length of the rows in a mine's grid. Small mines round up to the size of the fixed size solver that
+// handles them, bigger ones are packed
+static size_t gridRowLength(size_t mineSize) {
+    for (size_t fixedSize = 8; fixedSize <= SMALL_MINE_SIZE; fixedSize *= 2) {
+        if (mineSize <= fixedSize) {
+            return fixedSize;
+        }
+    }
+    return mineSize;
+}
+
+// Events mined between progress updates and looks at the clock when there's a deadline
+static constexpr size_t CHECK_EVENTS = 1024;
+
+// A blast stencil lists the offsets from a TNT tile to every tile it blows up, in row-major order. They're
+// all made at compile time, so a blast is just a walk over a table
+struct BlastOffset {
+    ptrdiff_t row;
+    ptrdiff_t col;
+};
+
+struct BlastStencil {
+    const BlastOffset* first;
+    const BlastOffset* last;
+    size_t radius;
+
+    const BlastOffset* begin() const {
+        return first;
+    }
+    const BlastOffset* end() const {
+        return last;
+    }
+    // Every stencil is symmetric, so the first half of it points at tiles earlier in the board
+    const BlastOffset* middle() const {
+        return first + (last - first) / 2;
+    }
+};
+
+static constexpr bool inBlast(BlastShape shape, ptrdiff_t row, ptrdiff_t col, ptrdiff_t radius) {
+    ptrdiff_t rowSteps = row < 0 ? -row : row;
+    ptrdiff_t colSteps = col < 0 ? -col : col;
+    if (rowSteps == 0 && colSteps == 0) {
+        return false;
+    }
+    return shape == BLAST_CROSS ? rowSteps + colSteps <= radius : rowSteps <= radius && colSteps <= radius;
+}
+
+template <BlastShape Shape, size_t Radius>
+static constexpr size_t blastSize() {
+    constexpr ptrdiff_t reach = static_cast<ptrdiff_t>(Radius);
+    size_t count = 0;
+    for (ptrdiff_t row = -reach; row <= reach; ++row) {
+        for (ptrdiff_t col = -reach; col <= reach; ++col) {
+            count += inBlast(Shape, row, col, reach);
+        }
+    }
+    return count;
+}
+
+template <BlastShape Shape, size_t Radius>
+static constexpr array<BlastOffset, blastSize<Shape, Radius>()> makeBlastOffsets() {
+    constexpr ptrdiff_t reach = static_cast<ptrdiff_t>(Radius);
+    array<BlastOffset, blastSize<Shape, Radius>()> offsets {};
+    size_t next = 0;
+    for (ptrdiff_t row = -reach; row <= reach; ++row) {
+        for (ptrdiff_t col = -reach; col <= reach; ++col) {
+            if (inBlast(Shape, row, col, reach)) {
+                offsets[next++] = BlastOffset { row, col };
+            }
+        }
+    }
+    return offsets;
+}
+
+template <BlastShape Shape, size_t Radius>
+static constexpr auto BLAST_OFFSETS = makeBlastOffsets<Shape, Radius>();
+
+template <BlastShape Shape, size_t Radius>
+static constexpr BlastStencil makeStencil() {
+    return BlastStencil { BLAST_OFFSETS<Shape, Radius>.data(),
+                          BLAST_OFFSETS<Shape, Radius>.data() + BLAST_OFFSETS<Shape, Radius>.size(), Radius };
+}
+
+// Indexed by shape then radius, there's no radius 0
+static constexpr BlastStencil BLAST_STENCILS[2][MAX_BLAST_RADIUS + 1] = {
+    { {}, makeStencil<BLAST_CROSS, 1>(), makeStencil<BLAST_CROSS, 2>(), makeStencil<BLAST_CROSS, 3>() },
+    { {}, makeStencil<BLAST_SQUARE, 1>(), makeStencil<BLAST_SQUARE, 2>(), makeStencil<BLAST_SQUARE, 3>() },
+};
+static_assert(BLAST_OFFSETS<BLAST_CROSS, 1>.size() == 4 && BLAST_OFFSETS<BLAST_SQUARE, 1>.size() == 8);
+
+// Most tiles one TNT can blow up, the biggest square
+static constexpr size_t MAX_BLAST_TILES = (2 * MAX_BLAST_RADIUS + 1) * (2 * MAX_BLAST_RADIUS + 1) - 1;
+
+// Moves a row or column by an offset. Off the top or left edge wraps around to a huge index, so one
+// comparison against the size checks both edges
+static size_t offsetBy(size_t index, ptrdiff_t offset) {
+    return index + static_cast<size_t>(offset);
+}
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+
+// libzstd is only opened once a zstd mine shows up, since its headers aren't installed everywhere. These
+// match the streaming part of its API, which has been stable since 1.0
+struct ZstdInBuffer {
+    const void* src;
+    size_t size;
+    size_t pos;
+};
+struct ZstdOutBuffer {
+    void* dst;
+    size_t size;
+    size_t pos;
+};
+
+// Compressed input. A decoder thread inflates it into a small ring of blocks that the parser takes one
+// at a time, so decoding and parsing overlap and the whole mine is never held uncompressed. Blocks end
+// on whitespace so a rubble value is never split between two of them
+class DecodeBuffer : public streambuf {
+public:
+    enum Format { GZIP, ZSTD };
+
+    static constexpr size_t NUM_BLOCKS = 4;
+    static constexpr size_t BLOCK_BYTES = size_t(1) << 20;
+
+    // The first byte is enough to tell, a plain mine always starts with its input mode
+    static bool detect(streambuf* source, Format& format) {
+        int first = source->sgetc();
+        if (first == 0x1f) {
+            format = GZIP;
+            return true;
+        }
+        if (first == 0x28) {
+            format = ZSTD;
+            return true;
+        }
+        return false;
+    }
+
+    DecodeBuffer(streambuf* source, Format format) : source(source), blocks(NUM_BLOCKS), lengths(NUM_BLOCKS, 0) {
+        for (size_t block = 0; block < NUM_BLOCKS; ++block) {
+            blocks[block].resize(BLOCK_BYTES);
+            freeBlocks.push_back(block);
+        }
+        decoder = thread(&DecodeBuffer::decode, this, format);
+    }
+
+    ~DecodeBuffer() override {
+        {
+            lock_guard<mutex> lock(ringMutex);
+            cancelled = true;
+        }
+        blockFreed.notify_one();
+        decoder.join();
+    }
+
+    // Hands over everything decoded that hasn't been read yet, up to the end of the current block.
+    // False once the input is used up
+    bool nextBlock(const char*& begin, const char*& end) {
+        if (gptr() == egptr() && underflow() == traits_type::eof()) {
+            return false;
+        }
+        begin = gptr();
+        end = egptr();
+        setg(eback(), egptr(), egptr());
+        return true;
+    }
+
+    // Why decoding stopped early, empty if it didn't
+    string error() {
+        lock_guard<mutex> lock(ringMutex);
+        return decodeError;
+    }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+        unique_lock<mutex> lock(ringMutex);
+        if (reading < NUM_BLOCKS) {
+            freeBlocks.push_back(reading);
+            reading = NUM_BLOCKS;
+            blockFreed.notify_one();
+        }
+        blockFilled.wait(lock, [&] { return !filledBlocks.empty() || finished; });
+        if (filledBlocks.empty()) {
+            return traits_type::eof();
+        }
+        reading = filledBlocks.front();
+        filledBlocks.pop_front();
+        char* begin = blocks[reading].data();
+        setg(begin, begin, begin + lengths[reading]);
+        return traits_type::to_int_type(*begin);
+    }
+
+private:
+    streambuf* source;
+    thread decoder;
+    vector<vector<char>> blocks;
+    vector<size_t> lengths;
+    deque<size_t> freeBlocks;
+    deque<size_t> filledBlocks;
+    size_t reading = NUM_BLOCKS;   // Block the parser is on, NUM_BLOCKS if none
+    size_t writing = NUM_BLOCKS;   // Block the decoder is filling
+    size_t written = 0;
+    string carry;                  // The start of a value that didn't fit in the last block
+    bool cancelled = false;
+    bool finished = false;
+    string decodeError;
+    mutex ringMutex;
+    condition_variable blockFilled;
+    condition_variable blockFreed;
+
+    void decode(Format format) {
+        string failure = (format == GZIP) ? inflateGzip() : inflateZstd();
+        // Whatever is left over, including a value carried past the last full block
+        if (failure.empty() && (writing < NUM_BLOCKS || (!carry.empty() && takeBlock()))) {
+            ship(true);
+        }
+        {
+            lock_guard<mutex> lock(ringMutex);
+            decodeError = failure;
+            finished = true;
+        }
+        blockFilled.notify_one();
+    }
+
+    // Waits for a free block to fill, false if the reader went away first
+    bool takeBlock() {
+        unique_lock<mutex> lock(ringMutex);
+        blockFreed.wait(lock, [&] { return !freeBlocks.empty() || cancelled; });
+        if (cancelled) {
+            return false;
+        }
+        writing = freeBlocks.front();
+        freeBlocks.pop_front();
+        lock.unlock();
+        std::copy(carry.begin(), carry.end(), blocks[writing].begin());
+        written = carry.size();
+        carry.clear();
+        return true;
+    }
+
+    // Gives the block being filled to the parser. Unless it's the last one it only goes up to its last
+    // whitespace and the rest is carried over to the next block
+    void ship(bool last) {
+        vector<char>& block = blocks[writing];
+        size_t length = written;
+        if (!last) {
+            while (length > 0 && !isSpace(block[length - 1])) {
+                --length;
+            }
+            // A value a whole block long is garbage anyway, it just gets split
+            if (length == 0) {
+                length = written;
+            }
+        }
+        carry.assign(block.begin() + static_cast<std::ptrdiff_t>(length),
+                     block.begin() + static_cast<std::ptrdiff_t>(written));
+        {
+            lock_guard<mutex> lock(ringMutex);
+            lengths[writing] = length;
+            filledBlocks.push_back(writing);
+        }
+        blockFilled.notify_one();
+        writing = NUM_BLOCKS;
+    }
+
+    // Copies decoded bytes into the ring, false if the reader went away
+    bool write(const char* data, size_t count) {
+        while (count > 0) {
+            if (writing == NUM_BLOCKS && !takeBlock()) {
+                return false;
+            }
+            size_t copied = std::min(count, BLOCK_BYTES - written);
+            std::copy(data, data + copied, blocks[writing].begin() + static_cast<std::ptrdiff_t>(written));
+            written += copied;
+            data += copied;
+            count -= copied;
+            if (written == BLOCK_BYTES) {
+                ship(false);
+            }
+        }
+        return true;
+    }
+
+    string inflateGzip() {
+        z_stream stream {};
+        // Adding 32 has zlib read the gzip header itself
+        if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+            return "zlib could not be started";
+        }
+        vector<char> input(size_t(1) << 16);
+        vector<char> output(size_t(1) << 16);
+        string failure;
+        bool complete = false;
+        bool accepted = true;
+        while (accepted && failure.empty()) {
+            if (stream.avail_in == 0) {
+                std::streamsize bytesRead = source->sgetn(input.data(), static_cast<std::streamsize>(input.size()));
+                if (bytesRead <= 0) {
+                    break;
+                }
+                stream.next_in = reinterpret_cast<Bytef*>(input.data());
+                stream.avail_in = static_cast<uInt>(bytesRead);
+            }
+            stream.next_out = reinterpret_cast<Bytef*>(output.data());
+            stream.avail_out = static_cast<uInt>(output.size());
+            int status = inflate(&stream, Z_NO_FLUSH);
+            complete = (status == Z_STREAM_END);
+            if (complete) {
+                // gzip files can be several members back to back
+                inflateReset(&stream);
+            } else if (status != Z_OK && status != Z_BUF_ERROR) {
+                failure = stream.msg ? stream.msg : "corrupt gzip data";
+            }
+            accepted = write(output.data(), output.size() - stream.avail_out);
+        }
+        inflateEnd(&stream);
+        if (failure.empty() && !complete && accepted) {
+            failure = "the gzip data ends early";
+        }
+        return failure;
+    }
+
+    string inflateZstd() {
+        void* library = dlopen("libzstd.so.1", RTLD_NOW | RTLD_LOCAL);
+        if (!library) {
+            return "zstd input needs libzstd.so.1";
+        }
+        auto createStream = reinterpret_cast<void* (*)()>(dlsym(library, "ZSTD_createDStream"));
+        auto freeStream = reinterpret_cast<size_t (*)(void*)>(dlsym(library, "ZSTD_freeDStream"));
+        auto decompress = reinterpret_cast<size_t (*)(void*, ZstdOutBuffer*, ZstdInBuffer*)>(
+            dlsym(library, "ZSTD_decompressStream"));
+        auto isError = reinterpret_cast<unsigned (*)(size_t)>(dlsym(library, "ZSTD_isError"));
+        auto errorName = reinterpret_cast<const char* (*)(size_t)>(dlsym(library, "ZSTD_getErrorName"));
+        void* stream = (createStream && freeStream && decompress && isError && errorName) ? createStream() : nullptr;
+        if (!stream) {
+            dlclose(library);
+            return "libzstd.so.1 could not be used";
+        }
+
+        vector<char> input(size_t(1) << 17);
+        vector<char> output(size_t(1) << 17);
+        string failure;
+        size_t result = 1;
+        bool accepted = true;
+        while (accepted && failure.empty()) {
+            std::streamsize bytesRead = source->sgetn(input.data(), static_cast<std::streamsize>(input.size()));
+            if (bytesRead <= 0) {
+                break;
+            }
+            ZstdInBuffer in { input.data(), static_cast<size_t>(bytesRead), 0 };
+            ZstdOutBuffer out { output.data(), output.size(), output.size() };
+            // Keep going while there's input left or the last call filled all of the output
+            while (in.pos < in.size || out.pos == out.size) {
+                out.pos = 0;
+                result = decompress(stream, &out, &in);
+                if (isError(result)) {
+                    failure = errorName(result);
+                    break;
+                }
+                if (!write(output.data(), out.pos)) {
+                    accepted = false;
+                    break;
+                }
+            }
+        }
+        freeStream(stream);
+        dlclose(library);
+        // Zero means the last frame was finished and everything in it handed back
+        if (failure.empty() && result != 0 && accepted) {
+            failure = "the zstd data ends early";
+        }
+        return failure;
+    }
+};
+
+
+// Hardware counters around each phase of a run, for --hwcounters. Every counter is opened on its own and
+// inherited by the threads started after it, so one the CPU or the kernel won't give us just shows up
+// as "-" and the wall time is always there
+class PhaseCounters {
+public:
+    PhaseCounters() {
+        for (Counter& counter : counters) {
+            counter.fd = -1;
+        }
+    }
+
+    ~PhaseCounters() {
+        for (Counter& counter : counters) {
+            if (counter.fd >= 0) {
+                close(counter.fd);
+            }
+        }
+    }
+
+    void open() {
+        enabled = true;
+        for (Counter& counter : counters) {
+            perf_event_attr attributes {};
+            attributes.size = sizeof(attributes);
+            attributes.type = counter.type;
+            attributes.config = counter.config;
+            attributes.inherit = 1;
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+            attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            counter.fd = static_cast<int>(
+                syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+            if (counter.fd >= 0) {
+                numOpened++;
+            } else if (unavailable.empty()) {
+                unavailable = strerror(errno);
+            }
+        }
+    }
+
+    // Runs one phase, counting it if counters were asked for
+    template <typename Job>
+    void time(const string& phase, Job job) {
+        if (!enabled) {
+            job();
+            return;
+        }
+        array<Reading, NUM_COUNTERS> before = readAll();
+        auto start = std::chrono::steady_clock::now();
+        job();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        array<Reading, NUM_COUNTERS> after = readAll();
+
+        Phase result { phase, elapsed.count(), {} };
+        for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+            result.counts[i] = after[i].since(before[i]);
+        }
+        phases.push_back(result);
+    }
+
+    void print(ostream& os) const {
+        if (!enabled) {
+            return;
+        }
+        if (numOpened == 0) {
+            os << "Hardware counters are unavailable (" << unavailable << "), only wall time is shown\n";
+        } else if (!unavailable.empty()) {
+            os << "Some hardware counters are unavailable (" << unavailable << ")\n";
+        }
+        os << std::left << std::setw(12) << "phase" << std::right << std::setw(12) << "wall ms";
+        for (const Counter& counter : counters) {
+            os << std::setw(16) << counter.name;
+        }
+        os << std::setw(8) << "IPC" << '\n';
+        for (const Phase& phase : phases) {
+            os << std::left << std::setw(12) << phase.name << std::right << std::fixed << std::setprecision(3)
+               << std::setw(12) << phase.wallTime;
+            for (double count : phase.counts) {
+                printCount(os, count, 16, 0);
+            }
+            // Counter 0 is instructions and 1 is cycles
+            printCount(os, phase.counts[1] > 0 ? phase.counts[0] / phase.counts[1] : -1, 8, 2);
+            os << '\n';
+        }
+    }
+
+private:
+    struct Counter {
+        const char* name;
+        uint32_t type;
+        uint64_t config;
+        int fd;
+    };
+    static constexpr size_t NUM_COUNTERS = 5;
+    array<Counter, NUM_COUNTERS> counters { {
+        { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1 },
+        { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1 },
+        { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1 },
+        { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1 },
+        { "dTLB-misses", PERF_TYPE_HW_CACHE,
+          PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+          -1 },
+    } };
+
+    // A raw count along with how long the counter was enabled and actually running, since the kernel
+    // takes turns when there are more counters than the CPU has
+    struct Reading {
+        uint64_t value = 0;
+        uint64_t timeEnabled = 0;
+        uint64_t timeRunning = 0;
+        bool valid = false;
+
+        // Count between two readings scaled up for the time it wasn't running, -1 if there isn't one
+        double since(const Reading& earlier) const {
+            if (!valid || !earlier.valid) {
+                return -1;
+            }
+            double count = static_cast<double>(value - earlier.value);
+            uint64_t running = timeRunning - earlier.timeRunning;
+            uint64_t enabledFor = timeEnabled - earlier.timeEnabled;
+            if (running == 0) {
+                return count == 0 ? 0 : -1;
+            }
+            return count * static_cast<double>(enabledFor) / static_cast<double>(running);
+        }
+    };
+
+    struct Phase {
+        string name;
+        double wallTime;
+        array<double, NUM_COUNTERS> counts;
+    };
+
+    bool enabled = false;
+    size_t numOpened = 0;
+    string unavailable;   // Why the first counter that couldn't be opened wasn't
+    vector<Phase> phases;
+
+    array<Reading, NUM_COUNTERS> readAll() const {
+        array<Reading, NUM_COUNTERS> readings;
+        for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+            uint64_t values[3];
+            if (counters[i].fd >= 0 && read(counters[i].fd, values, sizeof(values)) == sizeof(values)) {
+                readings[i] = Reading { values[0], values[1], values[2], true };
+            }
+        }
+        return readings;
+    }
+
+    static void printCount(ostream& os, double count, int width, int precision) {
+        if (count < 0) {
+            os << std::setw(width) << "-";
+        } else {
+            os << std::setw(width) << std::setprecision(precision) << count;
+        }
+    }
+};
+
+
+// Prints a line about how far mining has got to stderr every interval, and whenever the process gets
+// SIGUSR1. SIGUSR1 has to be blocked before any other thread starts so this is the only one that
+// takes it
+class ProgressReporter {
+public:
+    static void blockSignal() {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    }
+
+    ProgressReporter(const MineProgress& progress, int interval)
+        : progress(progress), interval(interval), reporter(&ProgressReporter::run, this) {}
+
+    ~ProgressReporter() {
+        finished.store(true, std::memory_order_relaxed);
+        pthread_kill(reporter.native_handle(), SIGUSR1);
+        reporter.join();
+    }
+
+private:
+    const MineProgress& progress;
+    int interval;
+    atomic<bool> finished { false };
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    thread reporter;
+
+    void run() {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR1);
+        timespec wait { interval / 1000, (interval % 1000) * 1000000L };
+        auto lastTime = start;
+        uint64_t lastTiles = 0;
+        while (true) {
+            int received = interval > 0 ? sigtimedwait(&signals, nullptr, &wait) : sigwaitinfo(&signals, nullptr);
+            if (finished.load(std::memory_order_relaxed)) {
+                return;
+            }
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            uint64_t tiles = progress.tilesCleared.load(std::memory_order_relaxed);
+            std::chrono::duration<double> sinceStart = now - start;
+            std::chrono::duration<double> sinceLast = now - lastTime;
+            ostringstream line;
+            line << std::fixed << std::setprecision(1) << "Progress at " << sinceStart.count() << "s: ";
+            if (progress.mining.load(std::memory_order_relaxed)) {
+                line << tiles << " tiles (" << static_cast<uint64_t>(static_cast<double>(tiles - lastTiles)
+                                                                       / std::max(sinceLast.count(), 1e-9))
+                     << "/s) containing " << progress.rubbleCleared.load(std::memory_order_relaxed)
+                     << " rubble cleared, " << progress.frontier.load(std::memory_order_relaxed)
+                     << " tiles queued, miner at [" << progress.row.load(std::memory_order_relaxed) << ","
+                     << progress.col.load(std::memory_order_relaxed) << "]\n";
+            } else {
+                line << (tiles == 0 ? "reading the mine\n" : "mining is done\n");
+            }
+            cerr << line.str();
+            lastTime = now;
+            lastTiles = tiles;
+        }
+    }
+};
+
+
+// The benchmark build has its own main in benchmark.cpp
+#ifndef MINE_BENCHMARK
 int main(int argc, char* argv[]) {
     // Speed up io
     ios_base::sync_with_stdio(false);
 
-    // Set precision for median
-    cout << std::fixed << std::setprecision(2);
-
     MineBoard game;
     game.getOptions(argc, argv);
-    game.mine();
-    game.output();
+    if (game.isServer()) {
+        game.serve();
+        return 0;
+    }
+    if (game.isSweep()) {
+        game.sweep();
+        return 0;
+    }
+    PhaseCounters counters;
+    if (game.usesHwCounters()) {
+        counters.open();
+    }
+    unique_ptr<ProgressReporter> reporter;
+    if (game.getProgressInterval() >= 0) {
+        ProgressReporter::blockSignal();
+        reporter = std::make_unique<ProgressReporter>(game.getProgress(), game.getProgressInterval());
+    }
+    counters.time("readInput", [&] { game.readInput(); });
+    if (game.isValidating()) {
+        bool valid = false;
+        counters.time("validate", [&] { valid = game.validate(); });
+        counters.print(cerr);
+        return valid ? 0 : 1;
+    }
+    if (game.hasMiners()) {
+        counters.time("mine", [&] { game.mineTogether(); });
+        counters.time("output", [&] { game.outputMiners(); });
+        counters.print(cerr);
+        return 0;
+    }
+    if (game.usesCache()) {
+        counters.time("cached", [&] { game.mineCached(); });
+    } else {
+        counters.time("mine", [&] { game.mine(); });
+        counters.time("output", [&] { game.output(); });
+    }
+    counters.print(cerr);
+}
+#endif
+
+MineBoard::MineBoard() {
+    // Set precision for median
+    out << std::fixed << std::setprecision(2);
+}
+
+// Out of line so the decoder's class doesn't have to be in the header
+MineBoard::~MineBoard() = default;
+
+// Gets the board ready for another run that reads from input and writes to output, keeping
+// all of the memory from the last run around so it doesn't have to be allocated again
+void MineBoard::reset(streambuf* input, streambuf* output) {
+    in.rdbuf(input);
+    decoder.reset();
+    in.clear();
+    out.rdbuf(output);
+    out.clear();
+    statsTiles.clear();
+    rubbleValues.clear();
+    componentOf.clear();
+    perimeterStart.clear();
+    perimeterTiles.clear();
+    blastTiles.clear();
+    rowsLoaded.store(0);
+    stopLoading.store(false);
+    loadError.clear();
+    numTNT = 0;
+    currRow = 0;
+    currCol = 0;
+    size = 0;
+    statsPrintNum = 0;
+    debugLineNum = 1;
+    tilesCleared = 0;
+    rubbleCleared = 0;
+    tntExplosions = 0;
+    verboseMode = false;
+    medianMode = false;
+    statsMode = false;
+    pipelineMode = false;
+    hasDeadline = false;
+    deadlineStarted = false;
+    timedOut = false;
+    blastShape = BLAST_CROSS;
+    blastRadius = 1;
+    blastPerTile = false;
+    optimalMode = false;
+    costMapPath.clear();
+    transcriptPath.clear();
+    transcript.close();
+    minerStarts.clear();
+    // Every option a request can give goes back to its default. The socket and the cache directory
+    // belong to the server and are left alone
+    numWorkers = 0;
+    progressInterval = -1;
+    hwCounters = false;
+    sweepRanges.clear();
+    sweepRuns = false;
+}
+
+// Ends the run. From the command line this exits the program, in server mode it only ends the
+// current request and the message goes back to the client
+void MineBoard::stop(int status, const string& message) {
+    if (serverMode) {
+        throw RunStopped { status, message };
+    }
+    cerr << message;
+    exit(status);
 }
 
 // Prints a help message if requested that explains all the options and what the program does
 // argv[0] is the name of the program
 void MineBoard::printHelp(char* argv[]) {
-    cout << "Usage: " << argv[0] << " -h | -m | -v | [-s <word>] |\n";
-    cout << "This program is used to convert a \"beginning\" word into an \"end\" word\n";
-    cout << "while only allowing specific single character conversions.\n\n";
-    cout << "-h: Prints a help message the explains the program and options\n";
-    cout << "-q: Directs the program to use a search container that behaves like a queue\n";
-    cout << "-s: Directs the program to use a search container that behaves like a stack\n";
-    cout << "-b <word>: Specifies the beginning word for the search\n";
-    cout << "-e <word>: Specifies the end word for the search\n";
-    cout << "-o (W|M): Specifies the output format, Word or Modification\n";
-    cout << "-c: Allows Letterman to change one letter into another during word morphs\n";
-    cout << "-l: Allows Letterman to insert or delete a single letter during word morphs\n";
-    cout << "-p: Allows Letterman to swap any two adjacent letters during word morphs" << endl;
+    out << "Usage: " << argv[0] << " [-h] [-v] [-m] [-s <N>] [-p] [-c <dir>] [-n <policy>]\n";
+    out << "       " << string(strlen(argv[0]), ' ') << " [--blast <shape>[:<radius>]] [--optimal] [--cost-map <file>]\n";
+    out << "       " << string(strlen(argv[0]), ' ') << " [--validate <file>] [--miners <row>,<col>[:...]]\n";
+    out << "       " << string(strlen(argv[0]), ' ') << " [--deadline <ms>] [--progress <ms>] [--hwcounters] < inputFile\n";
+    out << "       " << argv[0] << " -d <socket> [-j <workers>]\n";
+    out << "       " << argv[0] << " -w <ranges> [-W] [-j <workers>]\n";
+    out << "This program reads in a mine, then clears the easiest rubble (and blows up any TNT)\n";
+    out << "until the miner reaches the edge of the mine and escapes. The input file can also be\n";
+    out << "gzip or zstd compressed.\n\n";
+    out << "-h: Prints a help message the explains the program and options\n";
+    out << "-v: Prints every tile as it is cleared and every TNT explosion\n";
+    out << "-m: Prints the median rubble cleared after every tile\n";
+    out << "-s <N>: Prints the first, last, easiest and hardest N tiles cleared\n";
+    out << "-p: Starts mining while the rest of the mine is still being read in\n";
+    out << "-d <socket>: Runs as a server on a Unix socket. Each client sends the options for one run on\n";
+    out << "             the first line followed by the input file, then closes its end for writing. The\n";
+    out << "             reply is the exit status on the first line followed by what the run would print.\n";
+    out << "             Requests can't use --cost-map or --validate, which need files on the server\n";
+    out << "-j <workers>: Number of requests the server handles at once, or mines a sweep solves at once\n";
+    out << "              (default: one per core)\n";
+    out << "-w <ranges>: Solves a pseudorandom mine for every combination of the ranges and prints CSV\n";
+    out << "             statistics for each size, Max_Rubble and TNT over all of the seeds. The ranges look\n";
+    out << "             like size=50:250:50,seed=0:99,rubble=100,tnt=0:8:2 (first:last:step). The miner\n";
+    out << "             starts in the middle of the mine\n";
+    out << "-W: Also prints a CSV line for every mine in the sweep before the statistics\n";
+    out << "-c <dir>: Keeps the output in a cache directory, so running the same mine with the same flags\n";
+    out << "          again just copies it back. Other flags for the same mine reuse its cached events\n";
+    out << "-n <policy>: Where big mines go on a machine with more than one NUMA node, either interleave\n";
+    out << "             (spread over every node) or local (the node of the thread solving it)\n";
+    out << "--blast <shape>[:<radius>]: What TNT blows up, either cross (the 4 tiles next to it, the\n";
+    out << "                 default) or square (all 8 around it). A radius of up to 3 makes the blast\n";
+    out << "                 reach that many steps, and a radius of tile lets every TNT tile in the mine\n";
+    out << "                 have its own, written as -1, -2 or -3 instead of -1. Sweeps always use cross\n";
+    out << "--optimal: Also finds the cheapest escape, the path from the start to the edge through the\n";
+    out << "           least rubble (TNT counts as none), and prints it after everything else. The path\n";
+    out << "           itself is only printed with -v. -j sets the threads that search big mines\n";
+    out << "--cost-map <file>: Writes how much rubble the cheapest escape from every tile goes through,\n";
+    out << "                   as a 16 bit PGM image if the file ends in .pgm (scaled down if the costs\n";
+    out << "                   don't fit) or otherwise as \"MINECOST\", the size and the bytes per cost as\n";
+    out << "                   32 bit numbers, then every cost in row-major order, all little-endian\n";
+    out << "--validate <file>: Replays the clears in file, the output of an earlier run, against the mine\n";
+    out << "                   instead of printing them, and checks their order, the TNT, the medians,\n";
+    out << "                   the totals and the stats. -v, -m and -s are read from the file, its\n";
+    out << "                   cheapest escape needs --optimal. Reports the first line that's wrong\n";
+    out << "--miners <row>,<col>[:<row>,<col>...]: Mines with more miners at once, starting at these tiles\n";
+    out << "                 as well as the start in the mine. Each miner only mines tiles it finds before\n";
+    out << "                 the others, lower numbered miners win ties, and the output is the same for\n";
+    out << "                 every -j. Prints what each miner cleared, with -v every event too\n";
+    out << "--deadline <ms>: Stops once solving has taken this long and prints what was cleared so far,\n";
+    out << "                 saying that the miner didn't escape. The time starts once the mine is read, or\n";
+    out << "                 with -p once mining starts, and covers mining, --miners, --optimal and\n";
+    out << "                 --cost-map. Runs with a deadline skip the cache\n";
+    out << "--progress <ms>: Prints how far mining has got to standard error this often, or only when\n";
+    out << "                 the process gets SIGUSR1 if it's 0. SIGUSR1 always prints a line right away\n";
+    out << "--hwcounters: Prints the wall time and hardware counters (instructions, cycles, cache, branch\n";
+    out << "              and TLB misses) for reading the input, mining and the output to standard error\n";
 }
 
+// A number that isn't one, like -s abc, is reported the same way from the command line and to a
+// server's client
 void MineBoard::getOptions(int argc, char* argv[]) {
+    try {
+        parseOptions(argc, argv);
+    } catch (const std::logic_error& error) {
+        stop(1, "Invalid option argument (" + string(error.what()) + ")\n");
+    }
+}
+
+void MineBoard::parseOptions(int argc, char* argv[]) {
     opterr = false;
     int choice;
     int index = 0;
 
+    // Options with no short version get values past any character
+    enum LongOnlyOption { HW_COUNTERS = 256, DEADLINE, PROGRESS, BLAST, OPTIMAL, COST_MAP, VALIDATE, MINERS };
+
     // List of the options
     option long_options[] = {
-        {   "help",       no_argument, nullptr,  'h'},
-        {  "stats", required_argument, nullptr,  's'},
-        { "median",       no_argument, nullptr,  'm'},
-        {"verbose",       no_argument, nullptr,  'v'},
-        {  nullptr,                 0, nullptr, '\0'},
+        {    "help",       no_argument, nullptr,  'h'},
+        {   "stats", required_argument, nullptr,  's'},
+        {  "median",       no_argument, nullptr,  'm'},
+        { "verbose",       no_argument, nullptr,  'v'},
+        {"pipeline",       no_argument, nullptr,  'p'},
+        {  "daemon", required_argument, nullptr,  'd'},
+        { "workers", required_argument, nullptr,  'j'},
+        {   "sweep", required_argument, nullptr,  'w'},
+        {"sweep-runs",       no_argument, nullptr,  'W'},
+        {    "numa", required_argument, nullptr,  'n'},
+        {   "cache", required_argument, nullptr,  'c'},
+        {"hwcounters",       no_argument, nullptr, HW_COUNTERS},
+        {"deadline", required_argument, nullptr, DEADLINE},
+        {"progress", required_argument, nullptr, PROGRESS},
+        {   "blast", required_argument, nullptr, BLAST},
+        { "optimal",       no_argument, nullptr, OPTIMAL},
+        {"cost-map", required_argument, nullptr, COST_MAP},
+        {"validate", required_argument, nullptr, VALIDATE},
+        {  "miners", required_argument, nullptr,   MINERS},
+        {   nullptr,                 0, nullptr, '\0'},
     };
 
-    // Read input file
-    readInput();
+    // getopt keeps its place in globals, so server workers take turns and start it over every time
+    static mutex optionMutex;
+    lock_guard<mutex> lock(optionMutex);
+    optind = 0;
 
     // Actually get the desired option now and do something with it
-    while ((choice = getopt_long(argc, argv, "hmvs:", long_options, &index)) != -1) {
-        if (choice != 'h' && choice != 'm' && choice != 'v' && choice != 's') {
-            cerr << "Unknown command line option" << endl;
-            exit(1);
+    while ((choice = getopt_long(argc, argv, "hmvs:pd:j:w:Wn:c:", long_options, &index)) != -1) {
+        if (choice != 'h' && choice != 'm' && choice != 'v' && choice != 's' && choice != 'p' && choice != 'd'
+            && choice != 'j' && choice != 'w' && choice != 'W' && choice != 'n'
+            && choice != 'c' && choice != HW_COUNTERS
+            && choice != DEADLINE && choice != PROGRESS && choice != BLAST
+            && choice != OPTIMAL && choice != COST_MAP && choice != VALIDATE
+            && choice != MINERS) {
+            stop(1, "Unknown command line option\n");
         }
 
         switch (choice) {
         case 'h':
             printHelp(argv);
-            exit(0);
+            stop(0, "");
 
         case 'm':
             medianMode = true;
@@ -87,736 +986,2967 @@ void MineBoard::getOptions(int argc, char* argv[]) {
             statsPrintNum = static_cast<size_t>(arg);
             break;
         }
+
+        case 'p':
+            // A request to a server is already in memory, and mistakes in it have to be found before the
+            // status goes out
+            if (!serverMode) {
+                pipelineMode = true;
+            }
+            break;
+
+        case 'd':
+            // Only the command line can start a server, not a request to one
+            if (!serverMode) {
+                socketPath = optarg;
+            }
+            break;
+
+        case 'j':
+            numWorkers = static_cast<size_t>(stoi(optarg));
+            break;
+
+        case 'w':
+            sweepRanges = optarg;
+            break;
+
+        case 'W':
+            sweepRuns = true;
+            break;
+
+        case 'n': {
+            // The policy is for the whole process, so a request to a server can't change it
+            string policy { optarg };
+            if (policy != "interleave" && policy != "local") {
+                stop(1, "Invalid NUMA policy \"" + policy + "\"\n");
+            }
+            if (!serverMode) {
+                BoardMemory::setNumaPolicy(policy == "interleave" ? BoardMemory::NUMA_INTERLEAVE
+                                                                  : BoardMemory::NUMA_LOCAL);
+            }
+            break;
+        }
+
+        case 'c':
+            // A server caches every request or none of them
+            if (!serverMode) {
+                cacheDir = optarg;
+            }
+            break;
+
+        case HW_COUNTERS:
+            hwCounters = true;
+            break;
+
+        case DEADLINE: {
+            // Counted from when solving starts, see startDeadline()
+            int milliseconds { stoi(optarg) };
+            if (milliseconds < 0) {
+                stop(1, "Invalid deadline, it must be at least 0 ms\n");
+            }
+            hasDeadline = true;
+            deadlineBudget = std::chrono::milliseconds(milliseconds);
+            break;
+        }
+
+        case PROGRESS:
+            progressInterval = stoi(optarg);
+            if (progressInterval < 0) {
+                stop(1, "Invalid progress interval, it must be at least 0 ms\n");
+            }
+            break;
+
+        case BLAST: {
+            // A shape, then optionally a radius or "tile"
+            string blast { optarg };
+            size_t colon = std::min(blast.find(':'), blast.size());
+            string shape = blast.substr(0, colon);
+            string radius = colon < blast.size() ? blast.substr(colon + 1) : "1";
+            blastPerTile = (radius == "tile");
+            blastRadius = blastPerTile ? 1 : static_cast<size_t>(radius.size() == 1 ? radius[0] - '0' : 0);
+            if ((shape != "cross" && shape != "square") || blastRadius < 1 || blastRadius > MAX_BLAST_RADIUS) {
+                stop(1, "Invalid blast \"" + blast + "\"\n");
+            }
+            blastShape = (shape == "cross") ? BLAST_CROSS : BLAST_SQUARE;
+            break;
+        }
+
+        case OPTIMAL:
+            optimalMode = true;
+            break;
+
+        case COST_MAP:
+            costMapPath = optarg;
+            break;
+
+        case VALIDATE:
+            transcriptPath = optarg;
+            break;
+
+        case MINERS: {
+            // Row,column pairs separated by colons
+            string list { optarg };
+            istringstream starts(list);
+            for (string start; getline(starts, start, ':');) {
+                size_t comma = start.find(',');
+                string row = start.substr(0, std::min(comma, start.size()));
+                string col = comma == string::npos ? "" : start.substr(comma + 1);
+                if (row.empty() || col.empty() || row.size() > 9 || col.size() > 9
+                    || (row + col).find_first_not_of("0123456789") != string::npos) {
+                    stop(1, "Invalid miners \"" + list + "\"\n");
+                }
+                minerStarts.emplace_back(std::stoul(row), std::stoul(col));
+            }
+            if (minerStarts.empty()) {
+                stop(1, "Invalid miners \"" + list + "\"\n");
+            }
+            break;
+        }
         }
     }
 
-    // Do any optimizations if necessary
+    // A request can't make the server read or write its files
+    if (serverMode && (!costMapPath.empty() || isValidating())) {
+        stop(1, "--cost-map and --validate can't be used in a request to a server\n");
+    }
+
+    if (isValidating()) {
+        transcript.open(transcriptPath, ios_base::binary);
+        if (!transcript) {
+            stop(1, "Could not read the transcript " + transcriptPath + "\n");
+        }
+    }
 
-    // Error messages
+    // The other modes only make sense with one miner
+    if (hasMiners() && (medianMode || statsMode || optimalMode || isValidating())) {
+        stop(1, "--miners can't be used with -m, -s, --optimal or --validate\n");
+    }
 }
 
-vector<vector<Tile>> MineBoard::readInput() {
+void MineBoard::readInput() {
     char inputType;
     string junk;
-    int rubbleValue;
-    stringstream ss;
 
-    cin >> inputType;
-    cin >> junk;   // Reads in 'Size: ' from the second line
-    cin >> size;
-    cin >> junk;   // Reads in 'Start: ' from the third line
-    cin >> currRow;
-    cin >> currCol;
+    // A compressed mine is read through a decoder thread from here on
+    DecodeBuffer::Format format;
+    if (DecodeBuffer::detect(in.rdbuf(), format)) {
+        decoder = std::make_unique<DecodeBuffer>(in.rdbuf(), format);
+        in.rdbuf(decoder.get());
+    }
+
+    in >> inputType;
+    in >> junk;   // Reads in 'Size: ' from the second line
+    in >> size;
+    in >> junk;   // Reads in 'Start: ' from the third line
+    in >> currRow;
+    in >> currCol;
+    if (!in) {
+        checkDecoded();
+    }
 
     // Check that row and column are valid
     if (currRow > size) {
-        cerr << "Invalid starting row";
-        exit(1);
+        stop(1, "Invalid starting row");
     }
     if (currCol > size) {
-        cerr << "Invalid starting column";
-        exit(1);
+        stop(1, "Invalid starting column");
+    }
+    // Every miner has to start on its own tile of the mine
+    if (hasMiners()) {
+        map<pair<size_t, size_t>, size_t> firstMiner;
+        for (size_t i = 0; i <= minerStarts.size(); ++i) {
+            pair<size_t, size_t> start = (i == 0) ? make_pair(currRow, currCol) : minerStarts[i - 1];
+            if (start.first >= size || start.second >= size) {
+                stop(1, "Invalid start for miner " + to_string(i) + "\n");
+            }
+            auto found = firstMiner.emplace(start, i);
+            if (!found.second) {
+                stop(1, "Miners " + to_string(found.first->second) + " and " + to_string(i)
+                          + " start on the same tile\n");
+            }
+        }
     }
 
-    // Resize the map
-    map2D.resize(static_cast<size_t>(size), vector<Tile>(static_cast<size_t>(size)));
+    if (size > TileQueue::MAX_SIZE) {
+        stop(1, "Invalid size, mines can be at most " + to_string(TileQueue::MAX_SIZE) + " tiles across\n");
+    }
+
+    // Resize the map, a board that was used before keeps its rows
+    map2D.assign(static_cast<size_t>(size), gridRowLength(static_cast<size_t>(size)));
+
+    // A mine in the cache is known by its header, and for hand-written mines every rubble value, so
+    // the whole mine gets read before mining starts
+    boardKey = mixHash(mixHash(mixHash(mixHash(FNV_OFFSET, static_cast<unsigned char>(inputType)), size), currRow),
+                       currCol);
+    boardCached = false;
+    if (eventsFile >= 0) {
+        close(eventsFile);
+        eventsFile = -1;
+    }
+    // Cheapest escapes are found before mining starts, from the whole mine
+    if (usesCache() || optimalMode || !costMapPath.empty() || hasMiners()) {
+        pipelineMode = false;
+    }
+    // Other blasts give other events, the default is left out so older cache entries still match
+    if (blastShape != BLAST_CROSS || blastRadius != 1 || blastPerTile) {
+        boardKey = mixHash(mixHash(mixHash(boardKey, static_cast<uint64_t>(blastShape)), blastRadius), blastPerTile);
+    }
 
     // Pseudorandom input mode
     if (inputType == 'R') {
         uint32_t seed;
         uint32_t maxRubble;
-        uint32_t numTNT;
+        uint32_t tntChance;
+
+        in >> junk;        // Reads in 'Seed: ' from the fourth line
+        in >> seed;        // Must be non-negative
+        in >> junk;        // Reads in 'Max_Rubble: ' from the fifth line
+        in >> maxRubble;   // Must be non-negative
+        in >> junk;        // Reads in 'TNT: ' from the sixth line
+        in >> tntChance;   // Must be non-negative
+        // Rubble is picked modulo Max_Rubble
+        if (maxRubble == 0) {
+            stop(1, "Invalid Max_Rubble, it must be at least 1\n");
+        }
 
-        cin >> junk;        // Reads in 'Seed: ' from the fourth line
-        cin >> seed;        // Must be non-negative
-        cin >> junk;        // Reads in 'Max_Rubble: ' from the fifth line
-        cin >> maxRubble;   // Must be non-negative
-        cin >> junk;        // Reads in 'TNT: ' from the sixth line
-        cin >> numTNT;      // Must be non-negative
+        // The header is all there is to a pseudorandom mine, so a cached one never has to be made
+        if (usesCache()) {
+            boardKey = mixHash(mixHash(mixHash(boardKey, seed), maxRubble), tntChance);
+            eventsFile = open(cachePath(".events").c_str(), O_RDONLY | O_CLOEXEC);
+            boardCached = eventsFile >= 0;
+            if (boardCached) {
+                return;
+            }
+        }
 
-        P2random::PR_init(ss, static_cast<uint32_t>(size), seed, maxRubble, numTNT);
+        // In pipeline mode the miner starts right away and waits on rows that haven't been made yet.
+        // The TNT chains can't be found up front then, so detonate() finds them as they go off
+        if (pipelineMode) {
+            loader = thread(&MineBoard::generateRows, this, seed, maxRubble, tntChance);
+            return;
+        }
+        generateRows(seed, maxRubble, tntChance);
     } else if (inputType == 'M') {
-        // Do nothing
+        if (pipelineMode) {
+            loader = thread(&MineBoard::loadRows, this, std::ref(in));
+            return;
+        }
+        // Big hand-written mines get split up and parsed on every core, compressed ones are parsed as
+        // they're decoded
+        if (decoder) {
+            parseDecoded();
+        } else {
+            parseGrid();
+        }
+        if (usesCache()) {
+            for (size_t row = 0; row < size; ++row) {
+                for (size_t col = 0; col < size; ++col) {
+                    const Tile& tile = map2D[row][col];
+                    int rubble = tile.isTNT ? -static_cast<int>(tile.blastRadius) : tile.rubble;
+                    boardKey = mixHash(boardKey, static_cast<uint32_t>(rubble));
+                }
+            }
+            eventsFile = open(cachePath(".events").c_str(), O_RDONLY | O_CLOEXEC);
+            boardCached = eventsFile >= 0;
+            if (boardCached) {
+                return;
+            }
+        }
     }
     // Invalid input mode
     else {
-        cerr << "Invalid input mode";
-        exit(1);
+        stop(1, "Invalid input mode");
     }
 
-    // Sets the stringstream 'ss' to read just like cin would for map
-    istream& inputStream = (inputType == 'M') ? cin : ss;
+    // The whole mine is in, everything from here on counts against the deadline
+    startDeadline();
 
-    // Loop through the grid and read in the rubble value
-    for (size_t row = 0; row < size; ++row) {
-        for (size_t column = 0; column < size; ++column) {
-            inputStream >> rubbleValue;
-            map2D[row][column].rubble = rubbleValue;
-            map2D[row][column].rowNum = row;
-            map2D[row][column].colNum = column;
-            if (rubbleValue == -1) {
-                map2D[row][column].isTNT = true;
+    // Mining clears the rubble, so cheapest escapes have to be found first
+    if (optimalMode) {
+        findCheapestEscape();
+    }
+    if (!costMapPath.empty()) {
+        writeCostMap();
+    }
+
+    // Find the TNT chains up front so each one can be detonated all at once. More than one miner
+    // always finds them as they go off
+    if (numTNT > 0 && findsChainsUpFront() && !hasMiners()) {
+        findTNTComponents();
+    }
+}
+
+// Streams output straight to a socket
+class SocketBuffer : public streambuf {
+public:
+    explicit SocketBuffer(int socket) : socket(socket) {
+        setp(buffer, buffer + sizeof(buffer));
+    }
+
+    // Throws away anything that hasn't been sent yet
+    void discard() {
+        setp(buffer, buffer + sizeof(buffer));
+    }
+
+protected:
+    int overflow(int c) override {
+        if (sync() != 0) {
+            return traits_type::eof();
+        }
+        if (c != traits_type::eof()) {
+            *pptr() = static_cast<char>(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+        for (char* next = pbase(); next < pptr();) {
+            ssize_t sent = send(socket, next, static_cast<size_t>(pptr() - next), MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                return -1;
+            }
+            next += sent;
+        }
+        discard();
+        return 0;
+    }
+
+private:
+    int socket;
+    char buffer[1 << 16];
+};
+
+// Lets a request that is already in memory be read like any other stream without copying it
+class MemoryBuffer : public streambuf {
+public:
+    MemoryBuffer(char* begin, char* end) {
+        setg(begin, begin, end);
+    }
+};
+
+// How long a server worker waits to accept connections again after an error that isn't about one client
+static constexpr int ACCEPT_RETRY_MS = 100;
+
+// Listens on the socket from -d and hands connections to a fixed pool of workers. Every worker keeps
+// its own board so the memory from one request is reused by the next
+void MineBoard::serve() {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (listener < 0 || socketPath.size() >= sizeof(address.sun_path)) {
+        stop(1, "Invalid socket path\n");
+    }
+    std::copy(socketPath.begin(), socketPath.end(), address.sun_path);
+
+    // Clean up a socket left behind by an earlier server, anything else at the path is left alone
+    struct stat pathInfo;
+    if (lstat(socketPath.c_str(), &pathInfo) == 0) {
+        if (!S_ISSOCK(pathInfo.st_mode)) {
+            stop(1, "Could not listen on " + socketPath + ": something other than a socket is there\n");
+        }
+        unlink(socketPath.c_str());
+    }
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 128) != 0) {
+        stop(1, "Could not listen on " + socketPath + ": " + strerror(errno) + "\n");
+    }
+
+    if (numWorkers == 0) {
+        numWorkers = std::max(1U, thread::hardware_concurrency());
+    }
+    vector<thread> workers;
+    for (size_t i = 0; i < numWorkers; ++i) {
+        workers.emplace_back([listener, this] {
+            MineBoard game;
+            game.cacheDir = cacheDir;
+            string request;
+            while (true) {
+                int client = accept(listener, nullptr, nullptr);
+                if (client < 0) {
+                    // A client that gave up or a signal only costs that connection. Anything else, like
+                    // running out of file descriptors, lasts a while, so the worker waits before trying
+                    // again instead of spinning
+                    if (errno != EINTR && errno != ECONNABORTED) {
+                        cerr << "Could not accept a connection on " << socketPath << ": " << strerror(errno) << "\n";
+                        this_thread::sleep_for(std::chrono::milliseconds(ACCEPT_RETRY_MS));
+                    }
+                    continue;
+                }
+                game.handleRequest(client, request);
+                close(client);
+            }
+        });
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+}
+
+// Runs one request from a client: the options on the first line, then the input file until the client
+// stops sending. The reply is the exit status on its own line and then whatever the run printed
+void MineBoard::handleRequest(int client, string& request) {
+    request.clear();
+    char block[1 << 16];
+    ssize_t bytesRead;
+    while ((bytesRead = read(client, block, sizeof(block))) != 0) {
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        request.append(block, static_cast<size_t>(bytesRead));
+    }
+
+    // Split the first line up into arguments like a shell would (without quoting)
+    size_t lineEnd = std::min(request.find('\n'), request.size());
+    istringstream optionLine(request.substr(0, lineEnd));
+    vector<string> arguments { "mineEscape" };
+    for (string argument; optionLine >> argument;) {
+        arguments.push_back(argument);
+    }
+    vector<char*> argv;
+    for (string& argument : arguments) {
+        argv.push_back(&argument[0]);
+    }
+    argv.push_back(nullptr);
+
+    char* inputBegin = &request[0] + std::min(lineEnd + 1, request.size());
+    MemoryBuffer requestInput(inputBegin, &request[0] + request.size());
+    SocketBuffer reply(client);
+    reset(&requestInput, &reply);
+    serverMode = true;
+
+    try {
+        getOptions(static_cast<int>(arguments.size()), argv.data());
+        readInput();
+    } catch (const RunStopped& stopped) {
+        sendStopped(client, reply, stopped);
+        return;
+    }
+
+    out << "0\n";
+    if (hasMiners()) {
+        mineTogether();
+        outputMiners();
+    } else if (usesCache()) {
+        mineCached();
+    } else {
+        mine();
+        output();
+    }
+    out.flush();
+}
+
+// Replies to a request that ended before mining. Nothing but help gets printed before the input is
+// read and none of it has been sent yet, so the status can still go first
+void MineBoard::sendStopped(int client, SocketBuffer& reply, const RunStopped& stopped) {
+    if (stopped.status != 0) {
+        reply.discard();
+    }
+    string status = to_string(stopped.status) + "\n";
+    send(client, status.data(), status.size(), MSG_NOSIGNAL);
+    out << stopped.message;
+    out.flush();
+}
+
+// Turns one range from -w, like "size=50:250:50", into its name and the list of values
+static bool parseSweepRange(const string& text, string& name, vector<uint32_t>& values) {
+    size_t equals = text.find('=');
+    if (equals == string::npos) {
+        return false;
+    }
+    name = text.substr(0, equals);
+
+    unsigned long bounds[3] = { 0, 0, 1 };
+    size_t numBounds = 0;
+    istringstream rangeStream(text.substr(equals + 1));
+    for (string bound; std::getline(rangeStream, bound, ':');) {
+        if (numBounds == 3 || bound.empty() || bound.find_first_not_of("0123456789") != string::npos
+            || bound.size() > 9) {
+            return false;
+        }
+        bounds[numBounds++] = std::stoul(bound);
+    }
+    if (numBounds == 0) {
+        return false;
+    }
+    if (numBounds == 1) {
+        bounds[1] = bounds[0];
+    }
+    if (bounds[1] < bounds[0] || bounds[2] == 0) {
+        return false;
+    }
+
+    values.clear();
+    for (unsigned long value = bounds[0]; value <= bounds[1]; value += bounds[2]) {
+        values.push_back(static_cast<uint32_t>(value));
+    }
+    return true;
+}
+
+// Solves a pseudorandom mine made right in memory without printing anything, for sweeps
+void MineBoard::solveRandom(uint32_t mineSize, uint32_t seed, uint32_t maxRubble, uint32_t tntChance) {
+    reset(cin.rdbuf(), cout.rdbuf());
+    size = mineSize;
+    currRow = size / 2;
+    currCol = size / 2;
+    map2D.assign(size, gridRowLength(size));
+    generateRows(seed, maxRubble, tntChance);
+    if (numTNT > 0 && findsChainsUpFront()) {
+        findTNTComponents();
+    }
+    mine();
+}
+
+// Runs every combination of the ranges from -w across a pool of workers that each reuse one board,
+// then prints the distribution of each result over the seeds as CSV
+void MineBoard::sweep() {
+    vector<uint32_t> sizes;
+    vector<uint32_t> seeds;
+    vector<uint32_t> maxRubbles;
+    vector<uint32_t> tntChances { 0 };
+
+    istringstream rangesStream(sweepRanges);
+    for (string range; std::getline(rangesStream, range, ',');) {
+        string name;
+        vector<uint32_t> values;
+        if (!parseSweepRange(range, name, values)) {
+            stop(1, "Invalid sweep range \"" + range + "\"\n");
+        }
+        if (name == "size") {
+            sizes = values;
+        } else if (name == "seed") {
+            seeds = values;
+        } else if (name == "rubble") {
+            maxRubbles = values;
+        } else if (name == "tnt") {
+            tntChances = values;
+        } else {
+            stop(1, "Invalid sweep range \"" + range + "\"\n");
+        }
+    }
+    if (sizes.empty() || seeds.empty() || maxRubbles.empty() || sizes[0] == 0 || maxRubbles[0] == 0) {
+        stop(1, "Sweep needs a size, seed and rubble range, with sizes and rubble of at least 1\n");
+    }
+    for (uint32_t mineSize : sizes) {
+        if (mineSize > TileQueue::MAX_SIZE) {
+            stop(1, "Invalid size, mines can be at most " + to_string(TileQueue::MAX_SIZE) + " tiles across\n");
+        }
+    }
+
+    // Seeds are innermost so all the runs for one set of parameters end up next to each other
+    struct SweepRun {
+        uint32_t size;
+        uint32_t maxRubble;
+        uint32_t tntChance;
+        uint32_t seed;
+        int tilesCleared;
+        int rubbleCleared;
+        int tntExplosions;
+    };
+    vector<SweepRun> runs;
+    for (uint32_t mineSize : sizes) {
+        for (uint32_t maxRubble : maxRubbles) {
+            for (uint32_t tntChance : tntChances) {
+                for (uint32_t seed : seeds) {
+                    runs.push_back({ mineSize, maxRubble, tntChance, seed, 0, 0, 0 });
+                }
+            }
+        }
+    }
+
+    if (numWorkers == 0) {
+        numWorkers = std::max(1U, thread::hardware_concurrency());
+    }
+    atomic<size_t> nextRun { 0 };
+    auto solveRuns = [&] {
+        MineBoard board;
+        for (size_t i = nextRun++; i < runs.size(); i = nextRun++) {
+            board.solveRandom(runs[i].size, runs[i].seed, runs[i].maxRubble, runs[i].tntChance);
+            runs[i].tilesCleared = board.tilesCleared;
+            runs[i].rubbleCleared = board.rubbleCleared;
+            runs[i].tntExplosions = board.tntExplosions;
+        }
+    };
+    vector<thread> workers;
+    for (size_t i = 1; i < std::min(numWorkers, runs.size()); ++i) {
+        workers.emplace_back(solveRuns);
+    }
+    solveRuns();
+    for (thread& worker : workers) {
+        worker.join();
+    }
+
+    if (sweepRuns) {
+        out << "size,max_rubble,tnt,seed,tiles_cleared,rubble_cleared,tnt_explosions\n";
+        for (const SweepRun& run : runs) {
+            out << run.size << "," << run.maxRubble << "," << run.tntChance << "," << run.seed << ","
+                << run.tilesCleared << "," << run.rubbleCleared << "," << run.tntExplosions << "\n";
+        }
+        out << "\n";
+    }
+
+    // Percentiles are nearest-rank so they are always one of the actual results
+    auto printDistribution = [&](vector<int>& results) {
+        std::sort(results.begin(), results.end());
+        auto percentile = [&](size_t percent) {
+            return results[std::max<size_t>(1, (percent * results.size() + 99) / 100) - 1];
+        };
+        double total = 0;
+        for (int result : results) {
+            total += result;
+        }
+        out << "," << results.front() << "," << percentile(25) << "," << percentile(50) << "," << percentile(75)
+            << "," << results.back() << "," << total / static_cast<double>(results.size());
+    };
+
+    out << "size,max_rubble,tnt,runs";
+    for (const char* result : { "tiles", "rubble", "tnt_explosions" }) {
+        out << "," << result << "_min," << result << "_p25," << result << "_p50," << result << "_p75," << result
+            << "_max," << result << "_mean";
+    }
+    out << "\n";
+
+    vector<int> tiles;
+    vector<int> rubble;
+    vector<int> explosions;
+    for (size_t first = 0; first < runs.size(); first += seeds.size()) {
+        tiles.clear();
+        rubble.clear();
+        explosions.clear();
+        for (size_t i = first; i < first + seeds.size(); ++i) {
+            tiles.push_back(runs[i].tilesCleared);
+            rubble.push_back(runs[i].rubbleCleared);
+            explosions.push_back(runs[i].tntExplosions);
+        }
+        out << runs[first].size << "," << runs[first].maxRubble << "," << runs[first].tntChance << "," << seeds.size();
+        printDistribution(tiles);
+        printDistribution(rubble);
+        printDistribution(explosions);
+        out << "\n";
+    }
+    out.flush();
+}
+
+// Makes the pseudorandom mine right in the board instead of printing it and reading it back in
+void MineBoard::generateRows(uint32_t seed, uint32_t maxRubble, uint32_t tntChance) {
+    P2random::PR_generate(static_cast<uint32_t>(size), seed, maxRubble, tntChance,
+                          [this](uint32_t row, uint32_t col, int rubbleValue) {
+                              Tile& tile = map2D[row][col];
+                              tile.rubble = rubbleValue;
+                              tile.rowNum = row;
+                              tile.colNum = col;
+                              if (rubbleValue == -1) {
+                                  tile.isTNT = true;
+                                  numTNT++;
+                              }
+                              if (col + 1 < size) {
+                                  return true;
+                              }
+
+                              rowsLoaded.store(row + 1, std::memory_order_release);
+                              if (pipelineMode) {
+                                  { lock_guard<mutex> lock(loadMutex); }
+                                  rowLoaded.notify_one();
+                              }
+                              // The miner already escaped so the rest of the mine doesn't matter
+                              return !stopLoading.load(std::memory_order_relaxed);
+                          });
+}
+
+// Counts the rubble values and lines in a chunk of the mine
+static size_t countValues(const char* pos, const char* end, size_t& lines) {
+    size_t values = 0;
+    bool inValue = false;
+    for (; pos != end; ++pos) {
+        if (isSpace(*pos)) {
+            lines += (*pos == '\n');
+            inValue = false;
+        } else {
+            values += !inValue;
+            inValue = true;
+        }
+    }
+    return values;
+}
+
+static string missingValues(size_t valuesFound, size_t mineSize) {
+    return "Invalid mine: found " + to_string(valuesFound) + " rubble values but a " + to_string(mineSize) + "x"
+           + to_string(mineSize) + " mine needs " + to_string(mineSize * mineSize) + "\n";
+}
+
+// Parses a chunk of the mine into the tiles starting at value number firstValue (row-major). Values past
+// the end of the mine are ignored like cin would. Returns an error message for the first bad value or an
+// empty string if they were all fine
+string MineBoard::parseChunk(const char* pos, const char* end, size_t firstValue, size_t line, size_t& tntFound) {
+    size_t numTiles = size * size;
+    for (size_t index = firstValue; index < numTiles; ++index) {
+        while (pos != end && isSpace(*pos)) {
+            line += (*pos == '\n');
+            ++pos;
+        }
+        if (pos == end) {
+            break;
+        }
+
+        const char* token = pos;
+        bool negative = (*pos == '-');
+        if (negative) {
+            ++pos;
+        }
+        const char* digits = pos;
+        long long value = 0;
+        while (pos != end && *pos >= '0' && *pos <= '9') {
+            value = std::min(value * 10 + (*pos - '0'), 10000000000LL);
+            ++pos;
+        }
+        if (negative) {
+            value = -value;
+        }
+
+        size_t row = index / size;
+        size_t col = index % size;
+        // Anything other than a plain number, or a negative number other than TNT, is a typo. TNT with
+        // its own blast radius can go down to minus the biggest radius
+        long long lowest = blastPerTile ? -static_cast<long long>(MAX_BLAST_RADIUS) : -1;
+        if (pos == digits || (pos != end && !isSpace(*pos)) || value < lowest || value > INT_MAX) {
+            while (pos != end && !isSpace(*pos)) {
+                ++pos;
             }
+            return "Invalid rubble value \"" + string(token, pos) + "\" at [" + to_string(row) + "," + to_string(col)
+                   + "] on line " + to_string(line);
+        }
+
+        Tile& tile = map2D[row][col];
+        tile.rubble = static_cast<int>(std::max(value, -1LL));
+        tile.rowNum = row;
+        tile.colNum = col;
+        if (value < 0) {
+            tile.isTNT = true;
+            tile.blastRadius = static_cast<uint8_t>(-value);
+            tntFound++;
         }
     }
+    return "";
+}
 
-    return map2D;
+// Reads the grid in a line at a time, letting the miner know after every row. Lines are checked just
+// like parseGrid() checks them, and the first mistake is handed back to the miner, which stops the
+// run once it needs a row that isn't coming or when it's done. That's why the whole mine gets read
+// even after the miner escapes
+void MineBoard::loadRows(istream& inputStream) {
+    size_t numTiles = size * size;
+    size_t valuesFound = 0;
+    // The rest of the 'Start: ' line comes first
+    size_t line = 3;
+    string text;
+    string error;
+    while (error.empty() && std::getline(inputStream, text)) {
+        size_t lines = 0;
+        size_t lineValues = countValues(text.data(), text.data() + text.size(), lines);
+        error = parseChunk(text.data(), text.data() + text.size(), valuesFound, line, numTNT);
+        valuesFound += lineValues;
+        line++;
+
+        size_t rows = std::min(valuesFound, numTiles) / std::max<size_t>(size, 1);
+        if (rows > rowsLoaded.load(std::memory_order_relaxed)) {
+            rowsLoaded.store(rows, std::memory_order_release);
+            // Taking the lock makes sure a miner that just decided to wait can't miss this row
+            { lock_guard<mutex> lock(loadMutex); }
+            rowLoaded.notify_one();
+        }
+        // Values past the end of the mine are ignored, but a compressed mine still gets decoded to the end
+        if (valuesFound >= numTiles && !decoder) {
+            break;
+        }
+    }
+
+    if (decoder && !decoder->error().empty()) {
+        error = "Invalid compressed input: " + decoder->error();
+    } else if (error.empty() && valuesFound < numTiles) {
+        error = missingValues(valuesFound, size);
+        error.pop_back();
+    }
+    if (!error.empty()) {
+        {
+            lock_guard<mutex> lock(loadMutex);
+            loadError = error + "\n";
+        }
+        rowLoaded.notify_one();
+    }
+}
+
+// Parses a compressed mine a block at a time as the decoder thread hands them over
+void MineBoard::parseDecoded() {
+    size_t numTiles = size * size;
+    size_t valuesFound = 0;
+    size_t line = 3;
+    const char* begin;
+    const char* end;
+    while (decoder->nextBlock(begin, end)) {
+        // Values past the end of the mine are ignored, but the rest still gets decoded so a corrupt
+        // file is noticed
+        if (valuesFound >= numTiles) {
+            continue;
+        }
+        size_t lines = 0;
+        size_t blockValues = countValues(begin, end, lines);
+        string error = parseChunk(begin, end, valuesFound, line, numTNT);
+        if (!error.empty()) {
+            checkDecoded();
+            stop(1, error + "\n");
+        }
+        valuesFound += blockValues;
+        line += lines;
+    }
+    checkDecoded();
+    if (valuesFound < numTiles) {
+        stop(1, missingValues(valuesFound, size));
+    }
+    rowsLoaded.store(size, std::memory_order_release);
+}
+
+// Stops the run if the compressed input turned out to be broken
+void MineBoard::checkDecoded() {
+    string error = decoder ? decoder->error() : "";
+    if (!error.empty()) {
+        stop(1, "Invalid compressed input: " + error + "\n");
+    }
+}
+
+// Reads the whole mine after the header at once and parses it on every core. Each thread gets a
+// chunk of whole lines, and counting the values in every chunk first tells each one where its tiles go
+void MineBoard::parseGrid() {
+    // Whatever was read past the header is still sitting in the input's buffer
+    streambuf* inBuffer = in.rdbuf();
+    bool fromStdin = (inBuffer == cin.rdbuf());
+    size_t buffered = static_cast<size_t>(std::max<std::streamsize>(0, inBuffer->in_avail()));
+
+    // A regular file can just be mapped, anything else (like a pipe) gets read into memory
+    const char* text = nullptr;
+    size_t textSize = 0;
+    void* mapped = MAP_FAILED;
+    size_t mappedSize = 0;
+    vector<char>& copied = inputText;
+    copied.clear();
+    struct stat fileInfo;
+    off_t offset = fromStdin ? lseek(STDIN_FILENO, 0, SEEK_CUR) : -1;
+    if (fromStdin && fstat(STDIN_FILENO, &fileInfo) == 0 && S_ISREG(fileInfo.st_mode) && offset >= 0
+        && static_cast<size_t>(offset) >= buffered && fileInfo.st_size > 0) {
+        mappedSize = static_cast<size_t>(fileInfo.st_size);
+        mapped = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+    }
+    if (mapped != MAP_FAILED) {
+        madvise(mapped, mappedSize, MADV_SEQUENTIAL);
+        text = static_cast<const char*>(mapped) + (static_cast<size_t>(offset) - buffered);
+        textSize = mappedSize - (static_cast<size_t>(offset) - buffered);
+    } else if (fromStdin) {
+        copied.resize(buffered);
+        inBuffer->sgetn(copied.data(), static_cast<std::streamsize>(buffered));
+        char block[1 << 16];
+        ssize_t bytesRead;
+        while ((bytesRead = read(STDIN_FILENO, block, sizeof(block))) > 0) {
+            copied.insert(copied.end(), block, block + bytesRead);
+        }
+        text = copied.data();
+        textSize = copied.size();
+    } else {
+        copied.assign(istreambuf_iterator<char>(inBuffer), istreambuf_iterator<char>());
+        text = copied.data();
+        textSize = copied.size();
+    }
+
+    // Split on newlines, giving every thread at least a megabyte so small mines stay on one thread
+    size_t numChunks = std::max<size_t>(1, std::min<size_t>(thread::hardware_concurrency(), textSize >> 20));
+    vector<const char*> chunkStart(numChunks + 1, text + textSize);
+    chunkStart[0] = text;
+    for (size_t chunk = 1; chunk < numChunks; ++chunk) {
+        const char* split = std::max(chunkStart[chunk - 1], text + textSize * chunk / numChunks);
+        const char* newline = static_cast<const char*>(memchr(split, '\n', static_cast<size_t>(text + textSize - split)));
+        chunkStart[chunk] = newline ? newline + 1 : text + textSize;
+    }
+
+    // Runs the same job on every chunk, using the calling thread for the first one
+    auto forEachChunk = [&](auto job) {
+        vector<thread> workers;
+        for (size_t chunk = 1; chunk < numChunks; ++chunk) {
+            workers.emplace_back(job, chunk);
+        }
+        job(0);
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    };
+
+    // Count first so every chunk knows which tile it starts on. The text starts at the end of the
+    // 'Start: ' line, which is line 3
+    vector<size_t> firstValue(numChunks + 1, 0);
+    vector<size_t> firstLine(numChunks + 1, 0);
+    firstLine[0] = 3;
+    forEachChunk([&](size_t chunk) {
+        firstValue[chunk + 1] = countValues(chunkStart[chunk], chunkStart[chunk + 1], firstLine[chunk + 1]);
+    });
+    for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+        firstValue[chunk + 1] += firstValue[chunk];
+        firstLine[chunk + 1] += firstLine[chunk];
+    }
+    if (firstValue[numChunks] < size * size) {
+        stop(1, missingValues(firstValue[numChunks], size));
+    }
+
+    vector<string> errors(numChunks);
+    vector<size_t> tntFound(numChunks, 0);
+    forEachChunk([&](size_t chunk) {
+        errors[chunk] = parseChunk(chunkStart[chunk], chunkStart[chunk + 1], firstValue[chunk], firstLine[chunk],
+                                   tntFound[chunk]);
+    });
+
+    if (mapped != MAP_FAILED) {
+        munmap(mapped, mappedSize);
+    }
+
+    // Chunks are in order, so the first error found is the one closest to the top of the mine
+    for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+        if (!errors[chunk].empty()) {
+            stop(1, errors[chunk] + "\n");
+        }
+        numTNT += tntFound[chunk];
+    }
+    rowsLoaded.store(size, std::memory_order_release);
+}
+
+// Blocks until the given row has been read in, which is only ever true right away outside of pipeline
+// mode. A row the loader found a mistake before stops the run, and the deadline passing throws
+// DeadlinePassed
+void MineBoard::waitForRow(size_t row) {
+    if (row < rowsLoaded.load(std::memory_order_acquire)) {
+        return;
+    }
+    {
+        unique_lock<mutex> lock(loadMutex);
+        auto loaded = [&] { return row < rowsLoaded.load(std::memory_order_acquire) || !loadError.empty(); };
+        // A deadline also covers waiting for rows that are slow to load
+        if (deadlineStarted) {
+            if (!rowLoaded.wait_until(lock, deadline, loaded)) {
+                throw DeadlinePassed {};
+            }
+        } else {
+            rowLoaded.wait(lock, loaded);
+        }
+        if (row < rowsLoaded.load(std::memory_order_acquire)) {
+            return;
+        }
+    }
+    loader.join();
+    stop(1, loadError);
+}
+
+// Starts the clock for --deadline, if there is one and it hasn't started yet
+void MineBoard::startDeadline() {
+    if (hasDeadline && !deadlineStarted) {
+        deadline = std::chrono::steady_clock::now() + deadlineBudget;
+        deadlineStarted = true;
+    }
+}
+
+bool MineBoard::pastDeadline() const {
+    return deadlineStarted && std::chrono::steady_clock::now() >= deadline;
+}
+
+// Waits for the loader thread if there is one, and stops the run if it found a mistake in the mine. A
+// pseudorandom mine stops being made once the miner escapes
+void MineBoard::finishLoading() {
+    if (loader.joinable()) {
+        stopLoading.store(true, std::memory_order_relaxed);
+        loader.join();
+        if (!loadError.empty()) {
+            stop(1, loadError);
+        }
+    }
 }
 
 void MineBoard::output() {
     // Summary message
-    cout << "Cleared " << tilesCleared << " tiles containing " << rubbleCleared << " rubble and escaped." << endl;
+    out << "Cleared " << tilesCleared << " tiles containing " << rubbleCleared << " rubble";
+    if (timedOut) {
+        out << " but ran out of time before escaping." << endl;
+    } else {
+        out << " and escaped." << endl;
+    }
 
     if (statsMode) {
-        size_t vectorSize = statsTiles.size();
-        cout << "First tiles cleared:" << endl;
-
-        // If N is greater than size of vector then only loop through size
-        if (statsPrintNum > vectorSize) {
-            bool loopStop = true;
-            // Print first tiles
-            for (size_t i = 0; i < vectorSize; ++i) {
-                // TNT
+        outputStats();
+    }
+    if (optimalMode) {
+        outputCheapestEscape();
+    }
+}
+
+// Prints the first, last, easiest and hardest statsPrintNum tiles cleared
+void MineBoard::outputStats() {
+    size_t vectorSize = statsTiles.size();
+    out << "First tiles cleared:" << endl;
+
+    // If N is greater than size of vector then only loop through size
+    if (statsPrintNum > vectorSize) {
+        bool loopStop = true;
+        // Print first tiles
+        for (size_t i = 0; i < vectorSize; ++i) {
+            // TNT
+            if (statsTiles[i].isTNT) {
+                out << "TNT";
+            }
+            // Normal tile
+            else {
+                out << statsTiles[i].rubble;
+            }
+            out << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
+        }
+
+        out << "Last tiles cleared:" << endl;
+
+        // Print last tiles
+        if (vectorSize > 0) {
+            for (size_t i = vectorSize - 1; loopStop; --i) {
                 if (statsTiles[i].isTNT) {
-                    cout << "TNT";
+                    out << "TNT";
                 }
                 // Normal tile
                 else {
-                    cout << statsTiles[i].rubble;
+                    out << statsTiles[i].rubble;
+                }
+                out << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
+                if (i == 0) {
+                    loopStop = false;
                 }
-                cout << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
             }
+        }
 
-            cout << "Last tiles cleared:" << endl;
+        out << "Easiest tiles cleared:" << endl;
 
-            // Print last tiles
-            if (vectorSize > 0) {
-                for (size_t i = vectorSize - 1; loopStop; --i) {
-                    if (statsTiles[i].isTNT) {
-                        cout << "TNT";
-                    }
-                    // Normal tile
-                    else {
-                        cout << statsTiles[i].rubble;
-                    }
-                    cout << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
-                    if (i == 0) {
-                        loopStop = false;
-                    }
-                }
-            }
+        // Sort and print in order of easiest tiles
+        if (vectorSize > 0) {
+            std::sort(statsTiles.begin(), statsTiles.end(), EasyCompare);
+        }
 
-            cout << "Easiest tiles cleared:" << endl;
 
-            // Sort and print in order of easiest tiles
-            if (vectorSize > 0) {
-                std::sort(statsTiles.begin(), statsTiles.end(), EasyCompare);
+        for (size_t i = 0; i < vectorSize; ++i) {
+            // TNT
+            if (statsTiles[i].isTNT) {
+                out << "TNT";
             }
+            // Normal tile
+            else {
+                out << statsTiles[i].rubble;
+            }
+            out << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
+        }
 
+        out << "Hardest tiles cleared:" << endl;
 
-            for (size_t i = 0; i < vectorSize; ++i) {
-                // TNT
+        // Print in order of hardest tiles
+        if (vectorSize > 0) {
+            loopStop = true;
+            for (size_t i = vectorSize - 1; loopStop; --i) {
                 if (statsTiles[i].isTNT) {
-                    cout << "TNT";
+                    out << "TNT";
                 }
                 // Normal tile
                 else {
-                    cout << statsTiles[i].rubble;
+                    out << statsTiles[i].rubble;
+                }
+                out << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
+                if (i == 0) {
+                    loopStop = false;
                 }
-                cout << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
             }
+        }
+    } else {
+        // Print first tiles
+        for (size_t i = 0; i < statsPrintNum; ++i) {
+            // TNT
+            if (statsTiles[i].isTNT) {
+                out << "TNT";
+            }
+            // Normal tile
+            else {
+                out << statsTiles[i].rubble;
+            }
+            out << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
+        }
 
-            cout << "Hardest tiles cleared:" << endl;
+        out << "Last tiles cleared:" << endl;
 
-            // Print in order of hardest tiles
-            if (vectorSize > 0) {
-                loopStop = true;
-                for (size_t i = vectorSize - 1; loopStop; --i) {
-                    if (statsTiles[i].isTNT) {
-                        cout << "TNT";
-                    }
-                    // Normal tile
-                    else {
-                        cout << statsTiles[i].rubble;
+        // Print last tiles
+        size_t start = vectorSize - 1;   // Starting index
+        //???
+        size_t end
+          = vectorSize >= statsPrintNum ? vectorSize - statsPrintNum : 0;   // Calculate end to avoid underflow
+
+        for (size_t i = start;; --i) {
+            if (statsTiles[i].isTNT) {
+                out << "TNT";
+            } else {
+                out << statsTiles[i].rubble;
+            }
+            out << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
+
+            if (i == 0 || i == end) {   // Check if we've reached the beginning or the end of the desired range
+                break;
+            }
+        }
+
+        out << "Easiest tiles cleared:" << endl;
+
+        // Sort and print in order of easiest tiles
+        std::sort(statsTiles.begin(), statsTiles.end(), EasyCompare);
+
+        for (size_t i = 0; i < statsPrintNum; ++i) {
+            // TNT
+            if (statsTiles[i].isTNT) {
+                out << "TNT";
+            }
+            // Normal tile
+            else {
+                out << statsTiles[i].rubble;
+            }
+            out << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
+        }
+
+        out << "Hardest tiles cleared:" << endl;
+
+        // Print in order of hardest tiles
+        for (size_t i = start;; --i) {
+            // TNT
+            if (statsTiles[i].isTNT) {
+                out << "TNT";
+            }
+            // Normal tile
+            else {
+                out << statsTiles[i].rubble;
+            }
+            out << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
+
+            if (i == 0 || i == end) {   // Check if we've reached the beginning or the end of the desired range
+                break;
+            }
+        }
+    }
+}
+
+// Prints the cheapest escape found before mining, and with -v the tiles along it
+void MineBoard::outputCheapestEscape() {
+    if (!escapeFound) {
+        out << "Cheapest escape: ran out of time before finding it." << endl;
+        return;
+    }
+    out << "Cheapest escape: " << escapePath.size() << " tiles containing " << escapeRubble << " rubble." << endl;
+    if (verboseMode) {
+        out << "Cheapest escape path:" << endl;
+        for (const Tile& tile : escapePath) {
+            if (tile.isTNT) {
+                out << "TNT";
+            } else {
+                out << tile.rubble;
+            }
+            out << " at [" << tile.rowNum << "," << tile.colNum << "]" << endl;
+        }
+    }
+}
+
+// Mines the whole board, printing everything as it happens
+void MineBoard::mine() {
+    startDeadline();
+    startMining();
+    // Starts on the miner's tile, so the progress published when nothing gets mined still makes sense
+    MineEvent event { MineEvent::CLEARED, currRow, currCol, 0 };
+    size_t numEvents = 0;
+    progress.mining.store(true, std::memory_order_relaxed);
+    // The search for the cheapest escape can use up the whole deadline
+    timedOut = pastDeadline();
+    try {
+        while (!timedOut && nextEvent(event)) {
+            record(event);
+            // Reading the clock costs more than most events, so it's only checked every so often
+            if (++numEvents % CHECK_EVENTS == 0) {
+                publishProgress(event);
+                timedOut = pastDeadline();
+            }
+        }
+    } catch (const DeadlinePassed&) {
+        timedOut = true;
+    }
+    publishProgress(event);
+    progress.mining.store(false, std::memory_order_relaxed);
+
+    finishLoading();
+}
+
+// Where the miner is up to, for a ProgressReporter on another thread
+void MineBoard::publishProgress(const MineEvent& event) {
+    progress.tilesCleared.store(static_cast<uint64_t>(tilesCleared), std::memory_order_relaxed);
+    progress.rubbleCleared.store(static_cast<uint64_t>(rubbleCleared), std::memory_order_relaxed);
+    progress.frontier.store(size <= SMALL_MINE_SIZE ? smallPQ.size() : primaryPQ.size(), std::memory_order_relaxed);
+    progress.row.store(static_cast<uint32_t>(event.row), std::memory_order_relaxed);
+    progress.col.store(static_cast<uint32_t>(event.col), std::memory_order_relaxed);
+}
+
+// Progress for all of the miners together, with the position of the mine's own miner
+void MineBoard::publishMinersProgress() {
+    uint64_t minersTiles = 0;
+    uint64_t minersRubble = 0;
+    size_t queued = 0;
+    for (const Miner& miner : miners) {
+        minersTiles += miner.tilesCleared;
+        minersRubble += miner.rubbleCleared;
+        queued += miner.frontier.size();
+    }
+    progress.tilesCleared.store(minersTiles, std::memory_order_relaxed);
+    progress.rubbleCleared.store(minersRubble, std::memory_order_relaxed);
+    progress.frontier.store(queued, std::memory_order_relaxed);
+    progress.row.store(static_cast<uint32_t>(miners[0].row), std::memory_order_relaxed);
+    progress.col.store(static_cast<uint32_t>(miners[0].col), std::memory_order_relaxed);
+}
+
+// Reads a transcript a line at a time and can look at the next line without taking it
+class TranscriptLines {
+public:
+    explicit TranscriptLines(istream& transcript) : transcript(transcript) {}
+
+    bool next(string& line) {
+        if (!peek()) {
+            return false;
+        }
+        line.swap(upcoming);
+        peeked = false;
+        ++lineNum;
+        return true;
+    }
+
+    // The next line, or nullptr at the end
+    const string* peek() {
+        if (!peeked) {
+            peeked = static_cast<bool>(getline(transcript, upcoming));
+        }
+        return peeked ? &upcoming : nullptr;
+    }
+
+    bool peekStartsWith(const char* prefix) {
+        const string* line = peek();
+        return line != nullptr && line->compare(0, strlen(prefix), prefix) == 0;
+    }
+
+    bool peekIs(const char* expected) {
+        const string* line = peek();
+        return line != nullptr && *line == expected;
+    }
+
+    // Number of the last line next() handed out
+    size_t number() const {
+        return lineNum;
+    }
+
+private:
+    istream& transcript;
+    string upcoming;
+    bool peeked = false;
+    size_t lineNum = 0;
+};
+
+// Matches a line against a pattern where every # is a whole number, which goes into values
+static bool matchLine(const string& line, const char* pattern, long long* values) {
+    const char* pos = line.data();
+    const char* end = pos + line.size();
+    for (const char* expected = pattern; *expected != '\0'; ++expected) {
+        if (*expected == '#') {
+            std::from_chars_result result = std::from_chars(pos, end, *values++);
+            if (result.ec != std::errc()) {
+                return false;
+            }
+            pos = result.ptr;
+        } else if (pos == end || *pos++ != *expected) {
+            return false;
+        }
+    }
+    return pos == end;
+}
+
+// Reads a line -v prints for an event
+static bool parseEventLine(const string& line, MineEvent& event) {
+    long long values[3];
+    if (matchLine(line, "Cleared: # at [#,#]", values)) {
+        event.type = MineEvent::CLEARED;
+    } else if (matchLine(line, "Cleared by TNT: # at [#,#]", values)) {
+        event.type = MineEvent::CLEARED_BY_TNT;
+    } else if (matchLine(line, "TNT explosion at [#,#]!", values + 1)) {
+        event.type = MineEvent::TNT_EXPLOSION;
+        values[0] = -1;
+    } else {
+        return false;
+    }
+    if (values[0] < -1 || values[0] > INT_MAX || values[1] < 0 || values[2] < 0) {
+        return false;
+    }
+    event.rubble = static_cast<int>(values[0]);
+    event.row = static_cast<size_t>(values[1]);
+    event.col = static_cast<size_t>(values[2]);
+    return true;
+}
+
+static string eventText(const MineEvent& event) {
+    string at = "[" + to_string(event.row) + "," + to_string(event.col) + "]";
+    switch (event.type) {
+    case MineEvent::CLEARED:
+        return "the miner clears " + to_string(event.rubble) + " rubble at " + at;
+    case MineEvent::CLEARED_BY_TNT:
+        return "TNT clears " + to_string(event.rubble) + " rubble at " + at;
+    case MineEvent::TNT_EXPLOSION:
+        break;
+    }
+    return "the TNT at " + at + " goes off";
+}
+
+// The median of every rubble value added so far, kept as the lower half in a max-heap and the upper
+// half in a min-heap so each one is only a couple of heap operations instead of a sort
+class RunningMedian {
+public:
+    void add(int value) {
+        if (lower.empty() || value <= lower.top()) {
+            lower.push(value);
+        } else {
+            upper.push(value);
+        }
+        if (lower.size() > upper.size() + 1) {
+            upper.push(lower.top());
+            lower.pop();
+        } else if (upper.size() > lower.size()) {
+            lower.push(upper.top());
+            upper.pop();
+        }
+    }
+
+    double median() const {
+        return lower.size() > upper.size() ? lower.top() : (lower.top() + upper.top()) / 2.0;
+    }
+
+private:
+    priority_queue<int> lower;
+    priority_queue<int, vector<int>, std::greater<int>> upper;
+};
+
+// Says what a transcript got wrong when it claims a different event than the one the miner makes next.
+// The miner has already made the expected one, so its tile is described as it was before
+string MineBoard::explainEvent(const MineEvent& expected, const MineEvent& claimed) {
+    string at = "[" + to_string(claimed.row) + "," + to_string(claimed.col) + "]";
+    if (claimed.row >= size || claimed.col >= size) {
+        return at + " isn't on the mine, " + eventText(expected) + " next";
+    }
+    if (claimed.row == expected.row && claimed.col == expected.col) {
+        if (claimed.type == expected.type) {
+            return "the tile at " + at + " has " + to_string(expected.rubble) + " rubble, not "
+                   + to_string(claimed.rubble);
+        }
+        if (expected.type == MineEvent::TNT_EXPLOSION) {
+            return "the tile at " + at + " is TNT, it goes off instead of being cleared";
+        }
+        if (claimed.type == MineEvent::TNT_EXPLOSION) {
+            return "the tile at " + at + " isn't TNT, " + eventText(expected);
+        }
+        return eventText(expected) + ", not " + (claimed.type == MineEvent::CLEARED ? "the miner" : "TNT");
+    }
+
+    const Tile& tile = map2D[claimed.row][claimed.col];
+    bool queued = size <= SMALL_MINE_SIZE ? smallPQ.contains(claimed.row, claimed.col)
+                                          : primaryPQ.contains(claimed.row, claimed.col);
+    if (claimed.type != expected.type) {
+        return eventText(expected) + " next, not that";
+    }
+    switch (expected.type) {
+    case MineEvent::CLEARED:
+        if (!tile.isDiscovered) {
+            return "the miner hasn't found " + at + " yet, " + eventText(expected) + " next";
+        }
+        if (!queued) {
+            return "the tile at " + at + " was already cleared, " + eventText(expected) + " next";
+        }
+        return "tiles cleared out of order, the miner takes the least rubble, then the lowest column, then the "
+               "lowest row, so it clears "
+               + to_string(expected.rubble) + " at [" + to_string(expected.row) + "," + to_string(expected.col)
+               + "] before " + to_string(tile.rubble) + " at " + at;
+    case MineEvent::TNT_EXPLOSION:
+        if (tile.rubble != -1) {
+            return "there's no TNT left at " + at + ", " + eventText(expected) + " next";
+        }
+        if (!tile.isDetonated) {
+            return "no blast has reached the TNT at " + at + " yet, " + eventText(expected) + " next";
+        }
+        return "TNT went off out of order, a chain goes off by the lowest column, then the lowest row, so "
+               + eventText(expected) + " first";
+    case MineEvent::CLEARED_BY_TNT:
+        if (!tile.isDetonated) {
+            return "no blast hit " + at + ", " + eventText(expected) + " next";
+        }
+        if (tile.rubble <= 0) {
+            return "the tile at " + at + " was already cleared, " + eventText(expected) + " next";
+        }
+        return "tiles cleared by TNT out of order, they go by the least rubble, then the lowest column, then the "
+               "lowest row, so "
+               + eventText(expected) + " first";
+    }
+    return "";
+}
+
+// Replays a transcript against the mine in one pass. Every clear and explosion it lists has to be the
+// one the miner makes next, every median the median of the rubble cleared so far, and the totals, the
+// stats and the cheapest escape have to match what was cleared. Which of those the transcript has is
+// read from the transcript itself. A transcript that ran out of time is checked as far as it got.
+// Prints the first line that breaks a rule and which rule it broke, and returns true if none did
+bool MineBoard::validate() {
+    static const char* const MEDIAN_PREFIX = "Median difficulty of clearing rubble is: ";
+    static const char* const RAN_OUT = "Cleared # tiles containing # rubble but ran out of time before escaping.";
+
+    TranscriptLines lines(transcript);
+    string mistake;
+    auto fail = [&](size_t lineNum, const string& what) {
+        if (mistake.empty()) {
+            mistake = "Line " + to_string(lineNum) + ": " + what + "\n";
+        }
+    };
+
+    // -v and -m show in the first line, -m with -v only after the first clear
+    MineEvent claimed {};
+    const string* first = lines.peek();
+    bool verbose = first != nullptr && parseEventLine(*first, claimed);
+    int medians = verbose ? -1 : lines.peekStartsWith(MEDIAN_PREFIX);
+
+    // Without -v a run that ran out of time only shows it in the summary, which comes first or after
+    // the last median. Mining checks the clock every CHECK_EVENTS events, so that's where it usually stopped,
+    // but with -p it can also stop waiting for a row, anywhere before a clear
+    long long summary[2] = { 0, 0 };
+    bool stoppedEarly = false;
+    size_t numEvents = 0;
+    auto stopsHere = [&] {
+        if (verbose) {
+            return false;
+        }
+        if (!stoppedEarly && (numEvents == 0 || medians == 1) && lines.peek() != nullptr) {
+            stoppedEarly = matchLine(*lines.peek(), RAN_OUT, summary);
+        }
+        return stoppedEarly && tilesCleared == summary[0] && numEvents % CHECK_EVENTS == 0;
+    };
+
+    RunningMedian median;
+    statsTiles.clear();
+    string line;
+    char expectedMedian[64];
+    MineEvent event { MineEvent::CLEARED, currRow, currCol, 0 };
+    startMining();
+    progress.mining.store(true, std::memory_order_relaxed);
+    while (mistake.empty() && !stopsHere() && nextEvent(event)) {
+        if (!verbose && stoppedEarly && tilesCleared == summary[0] && event.type != MineEvent::TNT_EXPLOSION) {
+            break;
+        }
+        if (++numEvents % CHECK_EVENTS == 0) {
+            publishProgress(event);
+        }
+        if (verbose) {
+            if (!lines.next(line)) {
+                fail(lines.number() + 1, "the transcript ends, but " + eventText(event) + " next");
+                break;
+            }
+            if (!parseEventLine(line, claimed)) {
+                stoppedEarly = matchLine(line, RAN_OUT, summary);
+                if (!stoppedEarly) {
+                    fail(lines.number(), "expected a clear or an explosion, " + eventText(event) + " next, not \""
+                                             + line + "\"");
+                }
+                break;
+            }
+            if (claimed.type != event.type || claimed.row != event.row || claimed.col != event.col
+                || claimed.rubble != event.rubble) {
+                fail(lines.number(), explainEvent(event, claimed));
+                break;
+            }
+        }
+
+        statsTiles.push_back(Tile { event.row, event.col, event.rubble });
+        if (event.type == MineEvent::TNT_EXPLOSION) {
+            statsTiles.back().isTNT = true;
+            tntExplosions++;
+            continue;
+        }
+        tilesCleared++;
+        rubbleCleared += event.rubble;
+        median.add(event.rubble);
+        if (medians == -1) {
+            medians = lines.peekStartsWith(MEDIAN_PREFIX);
+        }
+        if (medians == 1) {
+            snprintf(expectedMedian, sizeof(expectedMedian), "%.2f", median.median());
+            if (!lines.next(line)) {
+                fail(lines.number() + 1, "the transcript ends, but the median after " + to_string(tilesCleared)
+                                             + " tiles is " + expectedMedian);
+            } else if (!verbose && matchLine(line, RAN_OUT, summary)) {
+                // The medians stop on a summary that says the run ran out of time, but not after these tiles
+                fail(lines.number(), "the medians add up to " + to_string(tilesCleared - 1) + " tiles containing "
+                                         + to_string(rubbleCleared - event.rubble) + " rubble, not "
+                                         + to_string(summary[0]) + " and " + to_string(summary[1]));
+            } else if (line.compare(0, strlen(MEDIAN_PREFIX), MEDIAN_PREFIX) != 0
+                       || line.compare(strlen(MEDIAN_PREFIX), string::npos, expectedMedian) != 0) {
+                fail(lines.number(), "the median after " + to_string(tilesCleared) + " tiles is " + expectedMedian
+                                         + ", not \"" + line + "\"");
+            }
+        }
+    }
+    publishProgress(event);
+    progress.mining.store(false, std::memory_order_relaxed);
+    finishLoading();
+
+    // The totals, which a verbose transcript that ran out of time has already been read up to
+    if (mistake.empty() && !(verbose && stoppedEarly)) {
+        if (!lines.next(line)) {
+            fail(lines.number() + 1, "the transcript ends before the totals");
+        } else if (!matchLine(line, stoppedEarly ? RAN_OUT : "Cleared # tiles containing # rubble and escaped.",
+                              summary)) {
+            fail(lines.number(), "expected the totals, \"Cleared " + to_string(tilesCleared) + " tiles containing "
+                                     + to_string(rubbleCleared) + " rubble and escaped.\", not \"" + line + "\"");
+        }
+    }
+    if (mistake.empty() && (summary[0] != tilesCleared || summary[1] != rubbleCleared)) {
+        fail(lines.number(), "the clears add up to " + to_string(tilesCleared) + " tiles containing "
+                                 + to_string(rubbleCleared) + " rubble, not " + to_string(summary[0]) + " and "
+                                 + to_string(summary[1]));
+    }
+
+    // Checks the rest of a section against what this run would print for it
+    auto checkSection = [&](const string& printed) {
+        istringstream expected(printed);
+        string heading;
+        size_t entry = 0;
+        for (string expectedLine; mistake.empty() && getline(expected, expectedLine);) {
+            bool isHeading = expectedLine.back() == ':';
+            if (isHeading) {
+                heading = expectedLine.substr(0, expectedLine.size() - 1);
+                entry = 0;
+            } else {
+                ++entry;
+            }
+            if (!lines.next(line)) {
+                fail(lines.number() + 1, "the transcript ends, but it should go on with \"" + expectedLine + "\"");
+            } else if (line != expectedLine) {
+                string where = isHeading         ? "expected the heading"
+                               : heading.empty() ? "expected"
+                                                 : "line " + to_string(entry) + " of " + heading + " should be";
+                fail(lines.number(), where + " \"" + expectedLine + "\", not \"" + line + "\"");
+            }
+        }
+    };
+    auto printed = [&](void (MineBoard::*print)()) {
+        ostringstream text;
+        streambuf* destination = out.rdbuf(text.rdbuf());
+        (this->*print)();
+        out.rdbuf(destination);
+        return text.str();
+    };
+
+    // -s N shows up as N tiles under the first heading, read ahead to count them. If that's all of
+    // them, any bigger N prints the same
+    if (mistake.empty() && lines.peekIs("First tiles cleared:")) {
+        vector<string> firstLines;
+        lines.next(line);
+        size_t headingLine = lines.number();
+        while (!lines.peekIs("Last tiles cleared:") && lines.next(line)) {
+            firstLines.push_back(line);
+        }
+        statsPrintNum = firstLines.size() < statsTiles.size() ? firstLines.size() : statsTiles.size() + 1;
+        istringstream expected(printed(&MineBoard::outputStats));
+        string expectedLine;
+        getline(expected, expectedLine);
+        for (size_t i = 0; mistake.empty() && i < firstLines.size(); ++i) {
+            getline(expected, expectedLine);
+            if (firstLines[i] != expectedLine) {
+                string where = expectedLine.back() == ':'
+                                 ? "expected the heading"
+                                 : "line " + to_string(i + 1) + " of First tiles cleared should be";
+                fail(headingLine + i + 1, where + " \"" + expectedLine + "\", not \"" + firstLines[i] + "\"");
+            }
+        }
+        string rest;
+        for (string restLine; getline(expected, restLine);) {
+            rest += restLine + "\n";
+        }
+        checkSection(rest);
+    }
+
+    if (mistake.empty() && lines.peekStartsWith("Cheapest escape")) {
+        if (!optimalMode) {
+            lines.next(line);
+            fail(lines.number(), "checking the cheapest escape needs --optimal");
+        } else {
+            verboseMode = verbose;
+            checkSection(printed(&MineBoard::outputCheapestEscape));
+        }
+    }
+
+    if (mistake.empty() && lines.next(line)) {
+        fail(lines.number(), "the run is over, but the transcript goes on with \"" + line + "\"");
+    }
+    if (!mistake.empty()) {
+        out << mistake;
+        return false;
+    }
+    out << "The transcript matches, " << lines.number() << " lines checked." << endl;
+    return true;
+}
+
+// Puts the miner back on the starting tile, ready to hand out events. Call finishLoading() when done
+// with them, whether or not the miner escaped
+void MineBoard::startMining() {
+    if (size <= SMALL_MINE_SIZE) {
+        smallPQ.reset(size);
+    } else {
+        primaryPQ.reset(size);
+    }
+    // Without the precomputed perimeters, the tiles each chain hits get sorted as it goes off. For small
+    // mines that's cheaper anyway
+    sortBlasts = pipelineMode || !findsChainsUpFront();
+    detonatedTiles.clear();
+    skipPop = false;
+    phase = MINE_START;
+}
+
+// Mines until the next tile is cleared or TNT goes off and hands it back. Returns false once the
+// miner has escaped. Small mines index the board with a constant row length
+bool MineBoard::nextEvent(MineEvent& event) {
+    switch (gridRowLength(size)) {
+    case 8: {
+        FixedGrid<8> grid(map2D);
+        return nextEventWith(grid, smallPQ, event);
+    }
+    case 16: {
+        FixedGrid<16> grid(map2D);
+        return nextEventWith(grid, smallPQ, event);
+    }
+    case 32: {
+        FixedGrid<32> grid(map2D);
+        return nextEventWith(grid, smallPQ, event);
+    }
+    case 64: {
+        FixedGrid<64> grid(map2D);
+        return nextEventWith(grid, smallPQ, event);
+    }
+    default:
+        return nextEventWith(map2D, primaryPQ, event);
+    }
+}
+
+// Counts and prints an event the way the command line shows it
+void MineBoard::record(const MineEvent& event) {
+    if (event.type == MineEvent::TNT_EXPLOSION) {
+        tntExplosions++;
+        if (verboseMode) {
+            out << "TNT explosion at [" << event.row << "," << event.col << "]!" << endl;
+            debugLineNum++;
+        }
+        if (statsMode) {
+            statsTiles.push_back(Tile { event.row, event.col, event.rubble });
+            statsTiles.back().isTNT = true;
+        }
+        return;
+    }
+
+    if (verboseMode) {
+        out << (event.type == MineEvent::CLEARED ? "Cleared: " : "Cleared by TNT: ") << event.rubble << " at ["
+            << event.row << "," << event.col << "]" << endl;
+    }
+    rubbleCleared += event.rubble;
+    rubbleValues.push_back(event.rubble);
+    if (statsMode) {
+        statsTiles.push_back(Tile { event.row, event.col, event.rubble });
+    }
+    tilesCleared++;
+    if (medianMode) {
+        out << "Median difficulty of clearing rubble is: " << getMedian() << endl;
+    }
+    debugLineNum++;
+}
+
+// Takes the rubble off a tile, if it has any, and fills in the event for it
+static bool clearTile(Tile& tile, MineEvent::Type type, MineEvent& event) {
+    if (tile.rubble <= 0) {
+        return false;
+    }
+    event = MineEvent { type, tile.rowNum, tile.colNum, tile.rubble };
+    tile.rubble = 0;
+    return true;
+}
+
+// Gets ready to set off the chain starting at the current tile
+void MineBoard::startChain(bool escaping) {
+    blastTiles.clear();
+    chainEscapes = escaping;
+    phase = MINE_EXPLODE;
+}
+
+template <typename Grid, typename Queue>
+bool MineBoard::nextEventWith(Grid& grid, Queue& queue, MineEvent& event) {
+    while (true) {
+        switch (phase) {
+        case MINE_START:
+            // Add the starting tile to the queue
+            waitForRow(currRow);
+            grid[currRow][currCol].isDiscovered = true;
+            queue.push(TileQueue::key(grid[currRow][currCol]));
+            phase = MINE_MOVE;
+            // Starting tile is TNT
+            if (grid[currRow][currCol].rubble == -1) {
+                startChain(false);
+            } else if (clearTile(grid[currRow][currCol], MineEvent::CLEARED, event)) {
+                return true;
+            }
+            break;
+
+        case MINE_MOVE: {
+            // See where the miner can go, mining ends once the miner reaches the edge
+            if (currRow == 0 || currRow == size - 1 || currCol == 0 || currCol == size - 1) {
+                phase = MINE_ESCAPE;
+                break;
+            }
+
+            // Tile is going to be investigated (cleared) so remove it from PQ
+            if (skipPop) {
+                skipPop = false;
+            } else {
+                queue.pop();
+            }
+            waitForRow(currRow + 1);
+
+            // Add any undiscovered tiles to the primary queue, up, down, left and right
+            Tile* here = &grid[currRow][currCol];
+            for (ptrdiff_t offset : grid.neighbors()) {
+                Tile& neighbor = here[offset];
+                if (!neighbor.isDiscovered) {
+                    queue.push(TileQueue::key(neighbor));
+                    neighbor.isDiscovered = true;
+                }
+            }
+
+            // Set the new tile to be whatever is at the top of the queue
+            currRow = TileQueue::row(queue.top());
+            currCol = TileQueue::col(queue.top());
+
+            // If it is the final tile, deal with it differently
+            if (currRow == 0 || currRow == size - 1 || currCol == 0 || currCol == size - 1) {
+                phase = MINE_ESCAPE;
+            } else if (grid[currRow][currCol].rubble == -1) {
+                // Clear the vector of previously detonated tiles
+                detonatedTiles.clear();
+                startChain(false);
+            } else if (clearTile(grid[currRow][currCol], MineEvent::CLEARED, event)) {
+                return true;
+            }
+            break;
+        }
+
+        case MINE_EXPLODE: {
+            // One TNT tile goes off, the rest of the chain waits in chainPQ
+            grid[currRow][currCol].isDetonated = true;
+            const BlastStencil& stencil = blastStencil(grid[currRow][currCol]);
+            waitForRow(std::min(currRow + stencil.radius, size - 1));
+
+            // The edges only need checking when the blast reaches past one of them
+            Tile* neighbors[MAX_BLAST_TILES];
+            size_t numNeighbors = 0;
+            if (currRow >= stencil.radius && currRow + stencil.radius < size && currCol >= stencil.radius
+                && currCol + stencil.radius < size) {
+                Tile* center = &grid[currRow][currCol];
+                for (const BlastOffset& offset : stencil) {
+                    neighbors[numNeighbors++] = center + grid.offset(offset.row, offset.col);
+                }
+            } else {
+                for (const BlastOffset& offset : stencil) {
+                    size_t row = offsetBy(currRow, offset.row);
+                    size_t col = offsetBy(currCol, offset.col);
+                    if (row < size && col < size) {
+                        neighbors[numNeighbors++] = &grid[row][col];
                     }
-                    cout << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
-                    if (i == 0) {
-                        loopStop = false;
+                }
+            }
+
+            // Mark everything the blast hits, the rubble gets cleared from the component's perimeter after
+            for (size_t i = 0; i < numNeighbors; ++i) {
+                if (!neighbors[i]->isDetonated) {
+                    if (neighbors[i]->rubble == -1) {
+                        chainPQ.push(TileQueue::key(*neighbors[i]));
+                    } else if (sortBlasts && neighbors[i]->rubble > 0) {
+                        blastTiles.push_back(neighbors[i]);
                     }
+                    neighbors[i]->isDetonated = true;
                 }
             }
-        } else {
-            // Print first tiles
-            for (size_t i = 0; i < statsPrintNum; ++i) {
-                // TNT
-                if (statsTiles[i].isTNT) {
-                    cout << "TNT";
+
+            // Add any undiscovered tiles to the main PQ
+            for (size_t i = 0; i < numNeighbors; ++i) {
+                if (!neighbors[i]->isDiscovered) {
+                    detonatedTiles.push_back(neighbors[i]);
+                    neighbors[i]->isDiscovered = true;
                 }
-                // Normal tile
-                else {
-                    cout << statsTiles[i].rubble;
+            }
+
+            // Set current tnt tile to zero rubble because it has officially exploded
+            event = MineEvent { MineEvent::TNT_EXPLOSION, currRow, currCol, -1 };
+            grid[currRow][currCol].rubble = 0;
+            if (queue.contains(currRow, currCol)) {
+                queue.update(TileQueue::key(0, currRow, currCol));
+            }
+
+            // Change the current tile to whichever has highest priority tnt
+            if (!chainPQ.empty()) {
+                currRow = TileQueue::row(chainPQ.top());
+                currCol = TileQueue::col(chainPQ.top());
+                chainPQ.pop();
+                return true;
+            }
+
+            // All the tnt that could detonate did so. Without the precomputed perimeters, put the
+            // rubble the chain hit in the order the TNT queue would clear it
+            if (sortBlasts) {
+                std::sort(blastTiles.begin(), blastTiles.end(),
+                          [](const Tile* a, const Tile* b) { return TileCompare()(b, a); });
+                blastNext = blastTiles.data();
+                blastEnd = blastTiles.data() + blastTiles.size();
+            } else {
+                // The tile the miner ended up on is always part of the chain
+                uint32_t component = componentOf[currRow * size + currCol];
+                blastNext = perimeterTiles.data() + perimeterStart[component];
+                blastEnd = perimeterTiles.data() + perimeterStart[component + 1];
+            }
+            phase = MINE_CLEAR_BLAST;
+            return true;
+        }
+
+        case MINE_CLEAR_BLAST:
+            // Clear the rubble the chain hit, skipping anything an earlier blast or the miner already cleared
+            while (blastNext != blastEnd) {
+                Tile* tile = *blastNext++;
+                if (clearTile(*tile, MineEvent::CLEARED_BY_TNT, event)) {
+                    // Move it up in the PQ if the miner already found it
+                    if (queue.contains(tile->rowNum, tile->colNum)) {
+                        queue.update(TileQueue::key(*tile));
+                    }
+                    return true;
                 }
-                cout << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
             }
 
-            cout << "Last tiles cleared:" << endl;
+            if (chainEscapes) {
+                phase = MINE_DONE;
+                break;
+            }
+            // Add all the detonated tiles to the queue. The tile the chain started from stays queued
+            // (now with no rubble), so the next pop is skipped instead of removing it
+            skipPop = true;
+            for (size_t i = 0; i < detonatedTiles.size(); ++i) {
+                queue.push(TileQueue::key(*detonatedTiles[i]));
+            }
+            phase = MINE_MOVE;
+            break;
+
+        case MINE_ESCAPE:
+            // Miner has escaped, but the final tile still needs to be cleared
+            phase = MINE_DONE;
+            if (grid[currRow][currCol].rubble == -1) {
+                startChain(true);
+            } else if (clearTile(grid[currRow][currCol], MineEvent::CLEARED, event)) {
+                return true;
+            }
+            break;
 
-            // Print last tiles
-            size_t start = vectorSize - 1;   // Starting index
-            //???
-            size_t end
-              = vectorSize >= statsPrintNum ? vectorSize - statsPrintNum : 0;   // Calculate end to avoid underflow
+        case MINE_DONE:
+            return false;
+        }
+    }
+}
 
-            for (size_t i = start;; --i) {
-                if (statsTiles[i].isTNT) {
-                    cout << "TNT";
-                } else {
-                    cout << statsTiles[i].rubble;
-                }
-                cout << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
+// Tiles no miner has claimed yet
+static constexpr uint32_t NO_MINER = UINT32_MAX;
+static constexpr uint32_t NEVER_CLAIMED = UINT32_MAX;
 
-                if (i == 0 || i == end) {   // Check if we've reached the beginning or the end of the desired range
-                    break;
-                }
-            }
+// How many times a thread checks for the next step of a multi-miner run before it goes to sleep
+static constexpr size_t SPIN_WAITS = 256;
 
-            cout << "Easiest tiles cleared:" << endl;
+// Most rounds miners that are far apart go on their own between steps
+static constexpr size_t MAX_BATCH_ROUNDS = 256;
 
-            // Sort and print in order of easiest tiles
-            std::sort(statsTiles.begin(), statsTiles.end(), EasyCompare);
+// Claims a tile for the miner unless a lower numbered one already has. Any number of threads can try
+// at once, whoever tried the lowest number wins
+static void claimTile(uint32_t& claim, uint32_t miner) {
+    uint32_t current = __atomic_load_n(&claim, __ATOMIC_RELAXED);
+    while (miner < current) {
+        if (__atomic_compare_exchange_n(&claim, &current, miner, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+}
 
-            for (size_t i = 0; i < statsPrintNum; ++i) {
-                // TNT
-                if (statsTiles[i].isTNT) {
-                    cout << "TNT";
-                }
-                // Normal tile
-                else {
-                    cout << statsTiles[i].rubble;
+// Mines with the miner from the input and every one from --miners at once. They go a round at a
+// time: every miner moves to the easiest tile it has found on its own thread and tries to claim the
+// tiles next to it, the lowest numbered miner gets a tile more than one of them tried for, then the
+// TNT they stepped on goes off one miner after another. Threads only clear tiles their own miners
+// claimed and the tiles they both want are settled by the lowest number, so how they race doesn't
+// matter and every -j gives the same output. Each miner queues up what it won at the start of its next
+// move, so a round is one step for the threads unless TNT goes off, and miners far enough apart
+// that they can't meet go a batch of rounds in one step.
+// Threads own miners rather than regions of the board. A miner goes wherever its easiest tile is, so with
+// fixed regions it would be handed between threads every time it crossed a line, and a thread whose
+// region the miners crowd into would do all the work while the rest waited. The claims only lock
+// the tiles two miners reach for in the same round, which is the border regions were meant to give,
+// except that it moves with the miners
+void MineBoard::mineTogether() {
+    startDeadline();
+    claimedBy.assign(size * size, NO_MINER);
+    claimRound.assign(size * size, NEVER_CLAIMED);
+    miners.clear();
+    miners.resize(minerStarts.size() + 1);
+    for (size_t i = 0; i < miners.size(); ++i) {
+        Miner& miner = miners[i];
+        miner.startRow = (i == 0) ? currRow : minerStarts[i - 1].first;
+        miner.startCol = (i == 0) ? currCol : minerStarts[i - 1].second;
+        // readInput() already checked that the starts are on the mine and all different
+        Tile& start = map2D[miner.startRow][miner.startCol];
+        start.isDiscovered = true;
+        claimedBy[miner.startRow * size + miner.startCol] = static_cast<uint32_t>(i);
+        claimRound[miner.startRow * size + miner.startCol] = 0;
+        miner.frontier.push(TileQueue::key(start));
+        miner.top = miner.bottom = miner.startRow;
+        miner.left = miner.right = miner.startCol;
+    }
+    liveTNT.assign(size, [this](size_t row, size_t col) { return map2D[row][col].rubble == -1; });
+
+    size_t numThreads = std::min<size_t>(numWorkers > 0 ? numWorkers : std::max(1U, thread::hardware_concurrency()),
+                                         miners.size());
+
+    // Every thread has every numThreads'th miner and moves them for every round in the step, or only
+    // hands them their claims when TNT is about to go off
+    bool claiming = false;
+    uint32_t firstRound = 1;
+    size_t batchRounds = 1;
+    auto runMiners = [&](size_t worker) {
+        for (size_t i = worker; i < miners.size(); i += numThreads) {
+            Miner& miner = miners[i];
+            for (size_t round = 0; round < batchRounds && miner.active && !miner.onTNT; ++round) {
+                claimTiles(i);
+                if (!claiming) {
+                    moveMiner(i, firstRound + static_cast<uint32_t>(round));
                 }
-                cout << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
             }
+        }
+    };
 
-            cout << "Hardest tiles cleared:" << endl;
-
-            // Print in order of hardest tiles
-            for (size_t i = start;; --i) {
-                // TNT
-                if (statsTiles[i].isTNT) {
-                    cout << "TNT";
+    // A step is only one tile per miner, so the threads spin for a while before they sleep between steps.
+    // Rounds only ever start and finish with roundMutex held, so a thread can't miss its wake up
+    atomic<size_t> round { 0 };
+    atomic<size_t> numRunning { 0 };
+    bool finished = false;
+    mutex roundMutex;
+    condition_variable roundStarted;
+    condition_variable roundDone;
+    auto spinUntil = [](const auto& ready) {
+        for (size_t spin = 0; spin < SPIN_WAITS && !ready(); ++spin) {
+            this_thread::yield();
+        }
+        return ready();
+    };
+    vector<thread> workers;
+    for (size_t worker = 1; worker < numThreads; ++worker) {
+        workers.emplace_back([&, worker] {
+            size_t seenRound = 0;
+            while (true) {
+                auto started = [&] { return round.load(std::memory_order_acquire) != seenRound; };
+                if (!spinUntil(started)) {
+                    unique_lock<mutex> lock(roundMutex);
+                    roundStarted.wait(lock, [&] { return started() || finished; });
+                    if (finished) {
+                        return;
+                    }
                 }
-                // Normal tile
-                else {
-                    cout << statsTiles[i].rubble;
+                seenRound = round.load(std::memory_order_acquire);
+                runMiners(worker);
+                if (numRunning.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    lock_guard<mutex> lock(roundMutex);
+                    roundDone.notify_one();
                 }
-                cout << " at [" << statsTiles[i].rowNum << "," << statsTiles[i].colNum << "]" << endl;
+            }
+        });
+    }
+    auto runStep = [&](bool claimStep) {
+        claiming = claimStep;
+        if (numThreads == 1) {
+            runMiners(0);
+            return;
+        }
+        numRunning.store(numThreads - 1, std::memory_order_relaxed);
+        {
+            lock_guard<mutex> lock(roundMutex);
+            round.fetch_add(1, std::memory_order_release);
+        }
+        roundStarted.notify_all();
+        runMiners(0);
+        auto done = [&] { return numRunning.load(std::memory_order_acquire) == 0; };
+        if (!spinUntil(done)) {
+            unique_lock<mutex> lock(roundMutex);
+            roundDone.wait(lock, done);
+        }
+    };
 
-                if (i == 0 || i == end) {   // Check if we've reached the beginning or the end of the desired range
-                    break;
-                }
+    bool mining = true;
+    progress.mining.store(true, std::memory_order_relaxed);
+    while (mining) {
+        batchRounds = roundsApart();
+        runStep(false);
+        firstRound += static_cast<uint32_t>(batchRounds);
+
+        // Blasts reach into tiles other miners own, so every claim is queued up first and then they go
+        // off in order on this thread
+        bool detonating = std::any_of(miners.begin(), miners.end(), [](const Miner& miner) { return miner.onTNT; });
+        if (detonating) {
+            batchRounds = 1;
+            runStep(true);
+        }
+        mining = false;
+        for (size_t i = 0; i < miners.size(); ++i) {
+            if (miners[i].onTNT) {
+                detonateFor(i, firstRound - 1);
             }
+            mining = mining || miners[i].active;
+        }
+        publishMinersProgress();
+        if (mining && pastDeadline()) {
+            timedOut = true;
+            mining = false;
         }
     }
+    progress.mining.store(false, std::memory_order_relaxed);
+
+    {
+        lock_guard<mutex> lock(roundMutex);
+        finished = true;
+    }
+    roundStarted.notify_all();
+    for (thread& worker : workers) {
+        worker.join();
+    }
 }
 
-void MineBoard::mine() {
-    priority_queue<Tile*, vector<Tile*>, TileCompare> primaryPQ;
-    priority_queue<Tile*, vector<Tile*>, TileCompare> tntPQ;
-    // Vector of tile pointers so that I can shove them into the PQ afterward
-    vector<Tile*> detonatedTiles;
-    Tile junkTile;
-    junkTile.rubble = -1;
-    junkTile.rowNum = 0;
-    junkTile.colNum = 0;
-
-    // Add the starting tile to the queue
-    map2D[currRow][currCol].isDiscovered = true;
-    primaryPQ.push(&map2D[currRow][currCol]);
-    if (map2D[currRow][currCol].rubble > 0) {
-        if (verboseMode) {
-            cout << "Cleared: " << map2D[currRow][currCol].rubble << " at [" << currRow << "," << currCol << "]"
-                 << endl;
+// Moves a miner to the easiest tile it has found and clears it, then tries to claim the tiles next to
+// it. TNT waits until every miner has moved. A miner with nothing left to mine was boxed in by tiles
+// the others claimed
+void MineBoard::moveMiner(size_t index, uint32_t round) {
+    Miner& miner = miners[index];
+    if (!miner.active) {
+        return;
+    }
+
+    while (!miner.frontier.empty()) {
+        uint64_t key = miner.frontier.top();
+        miner.frontier.pop();
+        Tile& tile = map2D[TileQueue::row(key)][TileQueue::col(key)];
+        if (key != TileQueue::key(tile)) {
+            continue;
         }
-        rubbleValues.push_back(map2D[currRow][currCol].rubble);
-        rubbleCleared += map2D[currRow][currCol].rubble;
-        if (statsMode) {
-            statsTiles.push_back(map2D[currRow][currCol]);
+
+        miner.row = tile.rowNum;
+        miner.col = tile.colNum;
+        if (tile.rubble == -1) {
+            miner.onTNT = true;
+            return;
         }
-        map2D[currRow][currCol].rubble = 0;
-        tilesCleared++;
-        if (medianMode) {
-            cout << "Median difficulty of clearing rubble is: " << getMedian() << endl;
+        MineEvent event;
+        if (clearTile(tile, MineEvent::CLEARED, event)) {
+            recordFor(miner, event);
+        }
+        if (miner.row == 0 || miner.row == size - 1 || miner.col == 0 || miner.col == size - 1) {
+            miner.escaped = true;
+            miner.active = false;
+            return;
+        }
+
+        // Up, down, left and right. A tile another miner claimed this same round is still up for grabs
+        size_t here = miner.row * size + miner.col;
+        for (size_t neighbor : { here - size, here + size, here - 1, here + 1 }) {
+            uint32_t claimed = __atomic_load_n(&claimRound[neighbor], __ATOMIC_RELAXED);
+            if (claimed == NEVER_CLAIMED || claimed == round) {
+                __atomic_store_n(&claimRound[neighbor], round, __ATOMIC_RELAXED);
+                claimTile(claimedBy[neighbor], static_cast<uint32_t>(index));
+                miner.claims.push_back(static_cast<uint32_t>(neighbor));
+            }
         }
-        debugLineNum++;
+        return;
     }
-    // Starting tile is TNT
-    else if (map2D[currRow][currCol].rubble == -1) {
-        // Loop until the next tile is not TNT
-        while (map2D[currRow][currCol].rubble == -1) {
-            detonate(tntPQ, detonatedTiles);
+    miner.active = false;
+}
+
+// Queues up the tiles the miner claimed last round, now that every claim is in
+void MineBoard::claimTiles(size_t index) {
+    Miner& miner = miners[index];
+    for (uint32_t claim : miner.claims) {
+        if (__atomic_load_n(&claimedBy[claim], __ATOMIC_RELAXED) == index) {
+            Tile& tile = map2D[claim / size][claim % size];
+            tile.isDiscovered = true;
+            miner.frontier.push(TileQueue::key(tile));
+            miner.top = std::min(miner.top, tile.rowNum);
+            miner.bottom = std::max(miner.bottom, tile.rowNum);
+            miner.left = std::min(miner.left, tile.colNum);
+            miner.right = std::max(miner.right, tile.colNum);
         }
+    }
+    miner.claims.clear();
+}
 
-        // Clear out the tnt PQ for when it needs to be used again and set all those tiles to zero rubble
-        while (!tntPQ.empty()) {
-            // Only clear it if rubble isn't zero
-            if (map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble != 0) {
-                if (verboseMode) {
-                    cout << "Cleared by TNT: " << map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble << " at ["
-                         << tntPQ.top()->rowNum << "," << tntPQ.top()->colNum << "]" << endl;
-                }
-                rubbleCleared += map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble;
-                rubbleValues.push_back(map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble);
-                if (statsMode) {
-                    statsTiles.push_back(map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum]);
+// How many rounds every miner can go on its own without it mattering what the others do. The claims
+// from the last round are next to the tiles it had, so in k rounds a miner only steps on tiles within
+// k of them and only claims tiles within k + 1. That many rounds can go by in one step while no TNT is
+// in reach and no two miners can reach the same tile. 1 means the next step is a single round
+size_t MineBoard::roundsApart() const {
+    size_t rounds = MAX_BATCH_ROUNDS;
+    for (size_t i = 0; i < miners.size() && rounds > 1; ++i) {
+        const Miner& miner = miners[i];
+        if (!miner.active) {
+            continue;
+        }
+        for (size_t j = i + 1; j < miners.size(); ++j) {
+            const Miner& other = miners[j];
+            if (!other.active) {
+                continue;
+            }
+            size_t rowGap = std::max(other.top > miner.bottom ? other.top - miner.bottom : 0,
+                                     miner.top > other.bottom ? miner.top - other.bottom : 0);
+            size_t colGap = std::max(other.left > miner.right ? other.left - miner.right : 0,
+                                     miner.left > other.right ? miner.left - other.right : 0);
+            size_t gap = std::max(rowGap, colGap);
+            rounds = std::min(rounds, gap > 2 ? (gap - 1) / 2 - 1 : 0);
+        }
+        while (rounds > 1
+               && liveTNT.count(miner.top - std::min(miner.top, rounds), miner.left - std::min(miner.left, rounds),
+                                std::min(miner.bottom + rounds, size - 1), std::min(miner.right + rounds, size - 1))
+                      > 0) {
+            rounds /= 2;
+        }
+    }
+    return std::max<size_t>(rounds, 1);
+}
+
+// Sets off the TNT a miner stepped on, unless another miner's chain got to it first. Everything the
+// chain clears counts for this miner, and the tiles it uncovers that nobody had found become its own.
+// It escapes if the TNT was on the edge or the chain ends there
+void MineBoard::detonateFor(size_t index, uint32_t round) {
+    Miner& miner = miners[index];
+    miner.onTNT = false;
+    Tile& start = map2D[miner.row][miner.col];
+    // Like a single miner, TNT it starts on doesn't count as reaching the edge
+    bool onStart = (miner.row == miner.startRow && miner.col == miner.startCol);
+    bool fromEdge = !onStart && (miner.row == 0 || miner.row == size - 1 || miner.col == 0 || miner.col == size - 1);
+
+    if (start.rubble == -1) {
+        blastTiles.clear();
+        detonatedTiles.clear();
+        start.isDetonated = true;
+        chainPQ.push(TileQueue::key(start));
+        while (!chainPQ.empty()) {
+            Tile& tnt = map2D[TileQueue::row(chainPQ.top())][TileQueue::col(chainPQ.top())];
+            chainPQ.pop();
+            for (const BlastOffset& offset : blastStencil(tnt)) {
+                size_t row = offsetBy(tnt.rowNum, offset.row);
+                size_t col = offsetBy(tnt.colNum, offset.col);
+                if (row >= size || col >= size) {
+                    continue;
                 }
-                map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble = 0;
-                if (map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].sortBool) {
-                    sortQueue(primaryPQ, tntPQ.top()->rowNum, tntPQ.top()->colNum);
-                    map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].sortBool = false;
+                Tile& neighbor = map2D[row][col];
+                if (!neighbor.isDetonated) {
+                    if (neighbor.rubble == -1) {
+                        chainPQ.push(TileQueue::key(neighbor));
+                    } else if (neighbor.rubble > 0) {
+                        blastTiles.push_back(&neighbor);
+                    }
+                    neighbor.isDetonated = true;
                 }
-                tilesCleared++;
-                if (medianMode) {
-                    cout << "Median difficulty of clearing rubble is: " << getMedian() << endl;
+                if (!neighbor.isDiscovered) {
+                    neighbor.isDiscovered = true;
+                    detonatedTiles.push_back(&neighbor);
                 }
-                debugLineNum++;
             }
-
-            tntPQ.pop();
+            recordFor(miner, MineEvent { MineEvent::TNT_EXPLOSION, tnt.rowNum, tnt.colNum, -1 });
+            tnt.rubble = 0;
+            liveTNT.remove(tnt.rowNum, tnt.colNum);
+            if (&tnt != &start) {
+                requeueTile(tnt);
+            }
+            // Like a single miner, it ends up wherever the chain ended
+            miner.row = tnt.rowNum;
+            miner.col = tnt.colNum;
         }
 
-        // Add all the detonated tiles to the primaryPQ
-        primaryPQ.push(&junkTile);
-        for (size_t i = 0; i < detonatedTiles.size(); ++i) {
-            primaryPQ.push(detonatedTiles[i]);
+        std::sort(blastTiles.begin(), blastTiles.end(),
+                  [](const Tile* a, const Tile* b) { return TileCompare()(b, a); });
+        for (Tile* tile : blastTiles) {
+            MineEvent event;
+            if (clearTile(*tile, MineEvent::CLEARED_BY_TNT, event)) {
+                recordFor(miner, event);
+                requeueTile(*tile);
+            }
+        }
+        for (Tile* tile : detonatedTiles) {
+            claimedBy[tile->rowNum * size + tile->colNum] = static_cast<uint32_t>(index);
+            claimRound[tile->rowNum * size + tile->colNum] = round;
+            miner.frontier.push(TileQueue::key(*tile));
+            miner.top = std::min(miner.top, tile->rowNum);
+            miner.bottom = std::max(miner.bottom, tile->rowNum);
+            miner.left = std::min(miner.left, tile->colNum);
+            miner.right = std::max(miner.right, tile->colNum);
         }
     }
 
-    // See where the miner can go, loop will end once the miner
-    while (currRow != 0 && currRow != size - 1 && currCol != 0 && currCol != size - 1) {
-        // Tile is going to be investigated (cleared) so remove it from PQ
-        primaryPQ.pop();
+    if (fromEdge || miner.row == 0 || miner.row == size - 1 || miner.col == 0 || miner.col == size - 1) {
+        miner.escaped = true;
+        miner.active = false;
+    }
+}
 
-        // Add any undiscovered tiles to the primary queue
-        if (!map2D[currRow - 1][currCol].isDiscovered) {   // Up
-            primaryPQ.push(&map2D[currRow - 1][currCol]);
-            map2D[currRow - 1][currCol].isDiscovered = true;
-        }
-        if (!map2D[currRow + 1][currCol].isDiscovered) {   // Down
-            primaryPQ.push(&map2D[currRow + 1][currCol]);
-            map2D[currRow + 1][currCol].isDiscovered = true;
+// A chain changed a tile's rubble, so whichever miner owns it gets it queued again with its new key
+void MineBoard::requeueTile(const Tile& tile) {
+    uint32_t owner = claimedBy[tile.rowNum * size + tile.colNum];
+    if (owner != NO_MINER) {
+        miners[owner].frontier.push(TileQueue::key(tile));
+    }
+}
+
+// Counts an event for one miner and keeps what -v prints for it
+void MineBoard::recordFor(Miner& miner, const MineEvent& event) {
+    if (event.type == MineEvent::TNT_EXPLOSION) {
+        if (verboseMode) {
+            miner.events << "TNT explosion at [" << event.row << "," << event.col << "]!\n";
         }
-        if (!map2D[currRow][currCol - 1].isDiscovered) {   // Left
-            primaryPQ.push(&map2D[currRow][currCol - 1]);
-            map2D[currRow][currCol - 1].isDiscovered = true;
+        return;
+    }
+    if (verboseMode) {
+        miner.events << (event.type == MineEvent::CLEARED ? "Cleared: " : "Cleared by TNT: ") << event.rubble
+                     << " at [" << event.row << "," << event.col << "]\n";
+    }
+    miner.tilesCleared++;
+    miner.rubbleCleared += static_cast<uint64_t>(event.rubble);
+}
+
+// Prints what every miner cleared in order, after what it did with -v, then the totals
+void MineBoard::outputMiners() {
+    size_t totalTiles = 0;
+    uint64_t totalRubble = 0;
+    for (size_t i = 0; i < miners.size(); ++i) {
+        Miner& miner = miners[i];
+        if (verboseMode) {
+            out << "Miner " << i << " from [" << miner.startRow << "," << miner.startCol << "]:\n"
+                << miner.events.str();
         }
-        if (!map2D[currRow][currCol + 1].isDiscovered) {   // Right
-            primaryPQ.push(&map2D[currRow][currCol + 1]);
-            map2D[currRow][currCol + 1].isDiscovered = true;
+        out << "Miner " << i << " cleared " << miner.tilesCleared << " tiles containing " << miner.rubbleCleared
+            << " rubble";
+        if (miner.escaped) {
+            out << " and escaped at [" << miner.row << "," << miner.col << "]." << endl;
+        } else if (miner.active && timedOut) {
+            out << " but ran out of time before escaping." << endl;
+        } else {
+            out << " but was boxed in by the other miners." << endl;
         }
+        totalTiles += miner.tilesCleared;
+        totalRubble += miner.rubbleCleared;
+    }
+    out << "All " << miners.size() << " miners cleared " << totalTiles << " tiles containing " << totalRubble
+        << " rubble." << endl;
+}
 
-        // Set the new tile to be whatever is at the top of the queue
-        currRow = primaryPQ.top()->rowNum;
-        currCol = primaryPQ.top()->colNum;
+// Union-find root lookup with path halving. Roots are always the smallest index in their set,
+// so every parent index is smaller than the index pointing at it
+static uint32_t findRoot(BoardVector<uint32_t>& parent, uint32_t index) {
+    while (parent[index] != index) {
+        parent[index] = parent[parent[index]];
+        index = parent[index];
+    }
+    return index;
+}
 
-        // If it is the final tile, break loop and deal with it differently
-        if (currRow == 0 || currRow == size - 1 || currCol == 0 || currCol == size - 1) {
-            break;
-        }
+static void joinTiles(BoardVector<uint32_t>& parent, uint32_t a, uint32_t b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b) {
+        parent[b] = a;
+    } else if (b < a) {
+        parent[a] = b;
+    }
+}
 
-        if (map2D[currRow][currCol].rubble == -1) {
-            // Clear the vector of previously detonated tiles
-            detonatedTiles.clear();
+const BlastStencil& MineBoard::blastStencil(const Tile& tnt) const {
+    return BLAST_STENCILS[blastShape][blastPerTile ? tnt.blastRadius : blastRadius];
+}
 
-            // Loop until the next tile is not TNT
-            while (map2D[currRow][currCol].rubble == -1) {
-                detonate(tntPQ, detonatedTiles);
-            }
+// Labels every group of TNT tiles that set each other off and finds the rubble tiles their blasts
+// hit, so that detonate() can blow up a whole chain without rediscovering it one tile at a time.
+// Bands of rows are unioned on separate threads, then the seams between bands are joined
+void MineBoard::findTNTComponents() {
+    // Every TNT tile blasts the same way here, so the stencil of any tile will do
+    const BlastStencil& stencil = blastStencil(Tile {});
 
-            // Clear out the tnt PQ for when it needs to be used again and set all those tiles to zero rubble
-            while (!tntPQ.empty()) {
-                // Only clear it if rubble isn't zero
-                if (map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble != 0) {
-                    if (verboseMode) {
-                        cout << "Cleared by TNT: " << map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble << " at ["
-                             << tntPQ.top()->rowNum << "," << tntPQ.top()->colNum << "]" << endl;
-                    }
-                    rubbleCleared += map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble;
-                    rubbleValues.push_back(map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble);
-                    if (statsMode) {
-                        statsTiles.push_back(map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum]);
-                    }
-                    map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble = 0;
-                    // Reinsert it into PQ
-                    if (map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].sortBool) {
-                        sortQueue(primaryPQ, tntPQ.top()->rowNum, tntPQ.top()->colNum);
-                        map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].sortBool = false;
-                    }
-                    tilesCleared++;
-                    if (medianMode) {
-                        cout << "Median difficulty of clearing rubble is: " << getMedian() << endl;
+    BoardVector<uint32_t> parent(size * size);
+    for (size_t i = 0; i < parent.size(); ++i) {
+        parent[i] = static_cast<uint32_t>(i);
+    }
+
+    // Split the rows into bands, one per thread, but don't bother with tiny bands
+    size_t numBands = std::max<size_t>(1, std::min<size_t>(thread::hardware_concurrency(), size / 64));
+    size_t bandRows = (size + numBands - 1) / numBands;
+
+    // Each band only joins tiles inside of itself so threads never touch the same entries
+    auto joinBand = [&](size_t firstRow, size_t lastRow) {
+        for (size_t row = firstRow; row < lastRow; ++row) {
+            for (size_t col = 0; col < size; ++col) {
+                if (!map2D[row][col].isTNT) {
+                    continue;
+                }
+                // Blasts reach both ways, so only the tiles earlier in the band need looking at
+                for (const BlastOffset* offset = stencil.begin(); offset != stencil.middle(); ++offset) {
+                    size_t otherRow = offsetBy(row, offset->row);
+                    size_t otherCol = offsetBy(col, offset->col);
+                    if (otherRow >= firstRow && otherRow < size && otherCol < size && map2D[otherRow][otherCol].isTNT) {
+                        joinTiles(parent, static_cast<uint32_t>(row * size + col),
+                                  static_cast<uint32_t>(otherRow * size + otherCol));
                     }
-                    debugLineNum++;
                 }
-
-                tntPQ.pop();
-            }
-            primaryPQ.push(&junkTile);
-            for (size_t i = 0; i < detonatedTiles.size(); ++i) {
-                primaryPQ.push(detonatedTiles[i]);
             }
         }
-        // Just clear the tile normally if it is not TNT
-        else {
-            // Only clear it if rubble isn't zero
-            if (map2D[currRow][currCol].rubble > 0) {
-                if (verboseMode) {
-                    cout << "Cleared: " << map2D[currRow][currCol].rubble << " at [" << currRow << "," << currCol << "]"
-                         << endl;
-                }
-                rubbleCleared += map2D[currRow][currCol].rubble;
-                rubbleValues.push_back(map2D[currRow][currCol].rubble);
-                if (statsMode) {
-                    statsTiles.push_back(map2D[currRow][currCol]);
+    };
+
+    vector<thread> workers;
+    for (size_t band = 1; band < numBands; ++band) {
+        workers.emplace_back(joinBand, band * bandRows, std::min(size, (band + 1) * bandRows));
+    }
+    joinBand(0, std::min(size, bandRows));
+    for (thread& worker : workers) {
+        worker.join();
+    }
+
+    // Join the groups that cross the seam at the top of every band, from the rows a blast can reach
+    // across it
+    for (size_t seam = bandRows; seam < size; seam += bandRows) {
+        for (size_t row = seam; row < std::min(size, seam + stencil.radius); ++row) {
+            for (size_t col = 0; col < size; ++col) {
+                if (!map2D[row][col].isTNT) {
+                    continue;
                 }
-                map2D[currRow][currCol].rubble = 0;
-                tilesCleared++;
-                if (medianMode) {
-                    cout << "Median difficulty of clearing rubble is: " << getMedian() << endl;
+                for (const BlastOffset* offset = stencil.begin(); offset != stencil.middle(); ++offset) {
+                    size_t otherRow = offsetBy(row, offset->row);
+                    size_t otherCol = offsetBy(col, offset->col);
+                    if (otherRow < seam && otherCol < size && map2D[otherRow][otherCol].isTNT) {
+                        joinTiles(parent, static_cast<uint32_t>(row * size + col),
+                                  static_cast<uint32_t>(otherRow * size + otherCol));
+                    }
                 }
-                debugLineNum++;
             }
         }
     }
 
-    // Miner has escaped, maybe output goes here but could also go in main
-    if (map2D[currRow][currCol].rubble == -1) {
-        // The final tile is tnt
-        detonate(tntPQ, detonatedTiles);
-        while (!tntPQ.empty()) {
-            // Only clear it if rubble isn't zero
-            if (map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble != 0) {
-                if (verboseMode) {
-                    cout << "Cleared by TNT: " << map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble << " at ["
-                         << tntPQ.top()->rowNum << "," << tntPQ.top()->colNum << "]" << endl;
-                }
-                rubbleCleared += map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble;
-                rubbleValues.push_back(map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble);
-                if (statsMode) {
-                    statsTiles.push_back(map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum]);
-                }
-                map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].rubble = 0;
-                // Reinsert it into PQ
-                if (map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].sortBool) {
-                    sortQueue(primaryPQ, tntPQ.top()->rowNum, tntPQ.top()->colNum);
-                    map2D[tntPQ.top()->rowNum][tntPQ.top()->colNum].sortBool = false;
+    // Turn the roots into component ids. Parents always come earlier in the board so by the time
+    // a tile is reached its parent's entry already holds the id
+    uint32_t numComponents = 0;
+    for (size_t row = 0; row < size; ++row) {
+        for (size_t col = 0; col < size; ++col) {
+            if (!map2D[row][col].isTNT) {
+                continue;
+            }
+            size_t i = row * size + col;
+            parent[i] = (parent[i] == i) ? numComponents++ : parent[parent[i]];
+        }
+    }
+    componentOf = std::move(parent);
+
+    // Collect the rubble around each component, tiles with no rubble never need to be cleared.
+    // The first pass counts so every perimeter can sit in one array
+    perimeterStart.assign(numComponents + 1, 0);
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t row = 0; row < size; ++row) {
+            for (size_t col = 0; col < size; ++col) {
+                if (!map2D[row][col].isTNT) {
+                    continue;
                 }
-                tilesCleared++;
-                if (medianMode) {
-                    cout << "Median difficulty of clearing rubble is: " << getMedian() << endl;
+                size_t& next = perimeterStart[componentOf[row * size + col] + 1];
+                for (const BlastOffset& offset : stencil) {
+                    size_t otherRow = offsetBy(row, offset.row);
+                    size_t otherCol = offsetBy(col, offset.col);
+                    if (otherRow >= size || otherCol >= size) {
+                        continue;
+                    }
+                    Tile* neighbor = &map2D[otherRow][otherCol];
+                    if (neighbor->rubble > 0) {
+                        if (pass == 1) {
+                            perimeterTiles[next] = neighbor;
+                        }
+                        next++;
+                    }
                 }
-                debugLineNum++;
             }
+        }
 
-            tntPQ.pop();
+        // After counting turn the counts into starting offsets. After filling, every entry has been
+        // pushed forward by its own count, so shift them back down one component
+        if (pass == 0) {
+            for (size_t c = 1; c <= numComponents; ++c) {
+                perimeterStart[c] += perimeterStart[c - 1];
+            }
+            perimeterTiles.resize(perimeterStart[numComponents]);
+            std::copy_backward(perimeterStart.begin(), perimeterStart.end() - 1, perimeterStart.end());
+            perimeterStart[0] = 0;
         }
     }
-    // Tile does not need to be cleared
-    else if (map2D[currRow][currCol].rubble == 0) {
-        // Miner has simply escaped
-    }
-    // Tile has rubble
-    else {
-        // Clear tile
-        if (verboseMode) {
-            cout << "Cleared: " << map2D[currRow][currCol].rubble << " at [" << currRow << "," << currCol << "]"
-                 << endl;
+
+    // Put each perimeter in the order the TNT queue would clear it, spread across the same threads.
+    // A tile next to two TNT tiles of the same component only gets cleared once
+    vector<size_t> uniqueEnd(numComponents);
+    auto sortPerimeters = [&](size_t first, size_t last) {
+        for (size_t c = first; c < last; ++c) {
+            auto begin = perimeterTiles.begin() + static_cast<ptrdiff_t>(perimeterStart[c]);
+            auto end = perimeterTiles.begin() + static_cast<ptrdiff_t>(perimeterStart[c + 1]);
+            std::sort(begin, end, [](const Tile* a, const Tile* b) { return TileCompare()(b, a); });
+            uniqueEnd[c] = static_cast<size_t>(std::unique(begin, end) - perimeterTiles.begin());
         }
-        rubbleCleared += map2D[currRow][currCol].rubble;
-        rubbleValues.push_back(map2D[currRow][currCol].rubble);
-        if (statsMode) {
-            statsTiles.push_back(map2D[currRow][currCol]);
+    };
+
+    size_t perBand = (numComponents + numBands - 1) / numBands;
+    workers.clear();
+    for (size_t band = 1; band < numBands; ++band) {
+        workers.emplace_back(sortPerimeters, std::min<size_t>(numComponents, band * perBand),
+                             std::min<size_t>(numComponents, (band + 1) * perBand));
+    }
+    sortPerimeters(0, std::min<size_t>(numComponents, perBand));
+    for (thread& worker : workers) {
+        worker.join();
+    }
+
+    // Squeeze out the duplicates
+    size_t kept = 0;
+    for (size_t c = 0; c < numComponents; ++c) {
+        size_t first = perimeterStart[c];
+        perimeterStart[c] = kept;
+        for (size_t i = first; i < uniqueEnd[c]; ++i) {
+            perimeterTiles[kept++] = perimeterTiles[i];
         }
-        map2D[currRow][currCol].rubble = 0;
-        tilesCleared++;
-        if (medianMode) {
-            cout << "Median difficulty of clearing rubble is: " << getMedian() << endl;
+    }
+    perimeterStart[numComponents] = kept;
+    perimeterTiles.resize(kept);
+}
+
+// Lowers a cost that other threads might be lowering at the same time. True if it went down
+static bool lowerCost(uint64_t& slot, uint64_t cost) {
+    uint64_t current = __atomic_load_n(&slot, __ATOMIC_RELAXED);
+    while (cost < current) {
+        if (__atomic_compare_exchange_n(&slot, &current, cost, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return true;
         }
-        debugLineNum++;
     }
+    return false;
 }
 
-void MineBoard::detonate(priority_queue<Tile*, vector<Tile*>, TileCompare>& tntPQ, vector<Tile*>& detonatedTiles) {
-    // Add all adjacent tiles to the TNT priority queue if they haven't been added already
-    // Tile is on top row
-    if (currRow == 0) {
-        if (!map2D[currRow][currCol].isDetonated) {
-            map2D[currRow][currCol].isDetonated = true;
+// Frontiers smaller than this are relaxed on one thread, splitting them up costs more than it saves
+static constexpr size_t PARALLEL_FRONTIER = 4096;
+
+// Finds the least rubble on any path from one of the sources to every tile, counting both ends, with
+// delta-stepping. Tiles wait in buckets of costs delta wide and the cheapest bucket is relaxed a
+// whole frontier at a time until nothing in it gets cheaper. Big frontiers are split across threads,
+// which only ever lower a cost with a compare and swap. Returns false if the deadline passed first
+bool MineBoard::findPathCosts(const vector<uint32_t>& sources) {
+    size_t numTiles = size * size;
+    tileCost.resize(numTiles);
+    uint32_t maxCost = 0;
+    uint64_t totalCost = 0;
+    for (size_t row = 0; row < size; ++row) {
+        for (size_t col = 0; col < size; ++col) {
+            uint32_t cost = static_cast<uint32_t>(std::max(map2D[row][col].rubble, 0));
+            tileCost[row * size + col] = cost;
+            maxCost = std::max(maxCost, cost);
+            totalCost += cost;
         }
-        if (!map2D[currRow + 1][currCol].isDetonated) {
-            if (map2D[currRow + 1][currCol].isDiscovered) {
-                map2D[currRow + 1][currCol].sortBool = true;
+    }
+    pathCost.assign(numTiles, UINT64_MAX);
+
+    // Buckets about as wide as an average tile keep frontiers wide without relaxing much twice. Nothing
+    // can be queued more than maxCost past the bucket being relaxed, so a ring of buckets is enough
+    uint64_t delta = std::max<uint64_t>(1, totalCost / numTiles);
+    size_t numBuckets = static_cast<size_t>(maxCost / delta) + 2;
+    vector<vector<uint32_t>> buckets(numBuckets);
+    size_t numQueued = 0;
+    uint64_t bucket = UINT64_MAX;
+    for (uint32_t source : sources) {
+        pathCost[source] = tileCost[source];
+        buckets[static_cast<size_t>(pathCost[source] / delta % numBuckets)].push_back(source);
+        numQueued++;
+        bucket = std::min(bucket, pathCost[source] / delta);
+    }
+
+    size_t numThreads = numTiles < (size_t(1) << 16) ? 1
+                                                     : (numWorkers > 0 ? numWorkers
+                                                                       : std::max(1U, thread::hardware_concurrency()));
+    vector<uint32_t> frontier;
+    vector<vector<uint32_t>> lowered(numThreads);
+    auto relax = [&](size_t worker, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            uint32_t tile = frontier[i];
+            uint64_t cost = __atomic_load_n(&pathCost[tile], __ATOMIC_RELAXED);
+            // It got cheaper and was already relaxed from an earlier bucket
+            if (cost / delta != bucket) {
+                continue;
             }
-            tntPQ.push(&map2D[currRow + 1][currCol]);
-            map2D[currRow + 1][currCol].isDetonated = true;
-        }
-        // If not the top left corner, add the tile to the left
-        if (currCol != 0) {
-            if (!map2D[currRow][currCol - 1].isDetonated) {
-                if (map2D[currRow][currCol - 1].isDiscovered) {
-                    map2D[currRow][currCol - 1].sortBool = true;
-                }
-                tntPQ.push(&map2D[currRow][currCol - 1]);
-                map2D[currRow][currCol - 1].isDetonated = true;
+            size_t row = tile / size;
+            size_t col = tile % size;
+            uint32_t neighbors[4];
+            size_t numNeighbors = 0;
+            if (row > 0) {
+                neighbors[numNeighbors++] = static_cast<uint32_t>(tile - size);   // Up
             }
-        }
-        // If not the top right corner, add the tile to the right
-        if (currCol != size - 1) {
-            if (!map2D[currRow][currCol + 1].isDetonated) {
-                if (map2D[currRow][currCol + 1].isDiscovered) {
-                    map2D[currRow][currCol + 1].sortBool = true;
+            if (row < size - 1) {
+                neighbors[numNeighbors++] = static_cast<uint32_t>(tile + size);   // Down
+            }
+            if (col > 0) {
+                neighbors[numNeighbors++] = tile - 1;   // Left
+            }
+            if (col < size - 1) {
+                neighbors[numNeighbors++] = tile + 1;   // Right
+            }
+            for (size_t n = 0; n < numNeighbors; ++n) {
+                if (lowerCost(pathCost[neighbors[n]], cost + tileCost[neighbors[n]])) {
+                    lowered[worker].push_back(neighbors[n]);
                 }
-                tntPQ.push(&map2D[currRow][currCol + 1]);
-                map2D[currRow][currCol + 1].isDetonated = true;
             }
         }
+    };
 
-        // Add any undiscovered tiles to the main PQ
-        if (!map2D[currRow + 1][currCol].isDiscovered) {   // Down
-            detonatedTiles.push_back(&map2D[currRow + 1][currCol]);
-            map2D[currRow + 1][currCol].isDiscovered = true;
-        }
-        // Check for top left corner
-        if (currCol != 0) {
-            if (!map2D[currRow][currCol - 1].isDiscovered) {
-                detonatedTiles.push_back(&map2D[currRow][currCol - 1]);
-                map2D[currRow][currCol - 1].isDiscovered = true;
-            }
-        }
-        // Check for top right corner
-        if (currCol != size - 1) {
-            if (!map2D[currRow][currCol + 1].isDiscovered) {   // Right
-                detonatedTiles.push_back(&map2D[currRow][currCol + 1]);
-                map2D[currRow][currCol + 1].isDiscovered = true;
+    // The other threads wait between frontiers. Each one takes its share of the frontier every time
+    // the round goes up
+    mutex roundMutex;
+    condition_variable roundStarted;
+    condition_variable roundDone;
+    size_t round = 0;
+    size_t numRunning = 0;
+    bool finished = false;
+    vector<thread> workers;
+    for (size_t worker = 1; worker < numThreads; ++worker) {
+        workers.emplace_back([&, worker] {
+            size_t seenRound = 0;
+            while (true) {
+                {
+                    unique_lock<mutex> lock(roundMutex);
+                    roundStarted.wait(lock, [&] { return round != seenRound || finished; });
+                    if (finished) {
+                        return;
+                    }
+                    seenRound = round;
+                }
+                relax(worker, frontier.size() * worker / numThreads, frontier.size() * (worker + 1) / numThreads);
+                lock_guard<mutex> lock(roundMutex);
+                if (--numRunning == 0) {
+                    roundDone.notify_one();
+                }
             }
-        }
+        });
     }
-    // Tile is on bottom row
-    else if (currRow == size - 1) {
-        if (!map2D[currRow][currCol].isDetonated) {
-            map2D[currRow][currCol].isDetonated = true;
+
+    bool finishedInTime = true;
+    while (numQueued > 0) {
+        if (pastDeadline()) {
+            finishedInTime = false;
+            break;
         }
-        if (!map2D[currRow - 1][currCol].isDetonated) {
-            if (map2D[currRow - 1][currCol].isDiscovered) {
-                map2D[currRow - 1][currCol].sortBool = true;
-            }
-            tntPQ.push(&map2D[currRow - 1][currCol]);
-            map2D[currRow - 1][currCol].isDetonated = true;
+        while (buckets[static_cast<size_t>(bucket % numBuckets)].empty()) {
+            bucket++;
         }
-        // Check bottom left corner
-        if (currCol != 0) {
-            if (!map2D[currRow][currCol - 1].isDetonated) {
-                if (map2D[currRow][currCol - 1].isDiscovered) {
-                    map2D[currRow][currCol - 1].sortBool = true;
+        frontier.swap(buckets[static_cast<size_t>(bucket % numBuckets)]);
+        numQueued -= frontier.size();
+
+        while (!frontier.empty()) {
+            if (numThreads > 1 && frontier.size() >= PARALLEL_FRONTIER) {
+                {
+                    lock_guard<mutex> lock(roundMutex);
+                    round++;
+                    numRunning = numThreads - 1;
                 }
-                tntPQ.push(&map2D[currRow][currCol - 1]);
-                map2D[currRow][currCol - 1].isDetonated = true;
+                roundStarted.notify_all();
+                relax(0, 0, frontier.size() / numThreads);
+                unique_lock<mutex> lock(roundMutex);
+                roundDone.wait(lock, [&] { return numRunning == 0; });
+            } else {
+                relax(0, 0, frontier.size());
             }
-        }
-        // Check bottom right corner
-        if (currCol != size - 1) {
-            if (!map2D[currRow][currCol + 1].isDetonated) {
-                if (map2D[currRow][currCol + 1].isDiscovered) {
-                    map2D[currRow][currCol + 1].sortBool = true;
+
+            // Whatever got cheaper goes around again if it's still in this bucket, or waits for its own
+            frontier.clear();
+            for (vector<uint32_t>& tiles : lowered) {
+                for (uint32_t tile : tiles) {
+                    uint64_t tileBucket = pathCost[tile] / delta;
+                    if (tileBucket == bucket) {
+                        frontier.push_back(tile);
+                    } else {
+                        buckets[static_cast<size_t>(tileBucket % numBuckets)].push_back(tile);
+                        numQueued++;
+                    }
                 }
-                tntPQ.push(&map2D[currRow][currCol + 1]);
-                map2D[currRow][currCol + 1].isDetonated = true;
+                tiles.clear();
             }
         }
+        bucket++;
+    }
 
-        // Add any undiscovered tiles to the main PQ
-        if (!map2D[currRow - 1][currCol].isDiscovered) {   // Up
-            detonatedTiles.push_back(&map2D[currRow - 1][currCol]);
-            map2D[currRow - 1][currCol].isDiscovered = true;
-        }
-        // Check for bottom left corner
-        if (currCol != 0) {
-            if (!map2D[currRow][currCol - 1].isDiscovered) {   // Left
-                detonatedTiles.push_back(&map2D[currRow][currCol - 1]);
-                map2D[currRow][currCol - 1].isDiscovered = true;
-            }
-        }
-        // Check for bottom right corner
-        if (currCol != size - 1) {
-            if (!map2D[currRow][currCol + 1].isDiscovered) {   // Right
-                detonatedTiles.push_back(&map2D[currRow][currCol + 1]);
-                map2D[currRow][currCol + 1].isDiscovered = true;
-            }
-        }
+    {
+        lock_guard<mutex> lock(roundMutex);
+        finished = true;
     }
-    // Tile is on leftmost column and not a corner
-    if (currCol == 0 && currRow != 0 && currRow != size - 1) {
-        if (!map2D[currRow][currCol].isDetonated) {
-            map2D[currRow][currCol].isDetonated = true;
-        }
-        if (!map2D[currRow - 1][currCol].isDetonated) {
-            if (map2D[currRow - 1][currCol].isDiscovered) {
-                map2D[currRow - 1][currCol].sortBool = true;
-            }
-            tntPQ.push(&map2D[currRow - 1][currCol]);
-            map2D[currRow - 1][currCol].isDetonated = true;
-        }
-        if (!map2D[currRow + 1][currCol].isDetonated) {
-            if (map2D[currRow + 1][currCol].isDiscovered) {
-                map2D[currRow + 1][currCol].sortBool = true;
-            }
-            tntPQ.push(&map2D[currRow + 1][currCol]);
-            map2D[currRow + 1][currCol].isDetonated = true;
-        }
-        if (!map2D[currRow][currCol + 1].isDetonated) {
-            if (map2D[currRow][currCol + 1].isDiscovered) {
-                map2D[currRow][currCol + 1].sortBool = true;
-            }
-            tntPQ.push(&map2D[currRow][currCol + 1]);
-            map2D[currRow][currCol + 1].isDetonated = true;
-        }
+    roundStarted.notify_all();
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    return finishedInTime;
+}
 
-        // Add any undiscovered tiles to the main PQ
-        if (!map2D[currRow - 1][currCol].isDiscovered) {   // Up
-            detonatedTiles.push_back(&map2D[currRow - 1][currCol]);
-            map2D[currRow - 1][currCol].isDiscovered = true;
-        }
-        if (!map2D[currRow + 1][currCol].isDiscovered) {   // Down
-            detonatedTiles.push_back(&map2D[currRow + 1][currCol]);
-            map2D[currRow + 1][currCol].isDiscovered = true;
-        }
-        if (!map2D[currRow][currCol + 1].isDiscovered) {   // Right
-            detonatedTiles.push_back(&map2D[currRow][currCol + 1]);
-            map2D[currRow][currCol + 1].isDiscovered = true;
-        }
+// Finds the cheapest way from the start to the edge. Of the edge tiles that are cheapest to reach
+// the miner leaves from the one TileCompare puts first, and of the cheapest paths there it takes one
+// with the fewest tiles, so the answer doesn't depend on how the threads raced
+void MineBoard::findCheapestEscape() {
+    uint32_t start = static_cast<uint32_t>(currRow * size + currCol);
+    escapePath.clear();
+    escapeRubble = 0;
+    escapeFound = findPathCosts({ start });
+    if (!escapeFound) {
+        return;
     }
-    // Tile is in rightmost column and not a corner
-    else if (currCol == size - 1 && currRow != 0 && currRow != size - 1) {
-        if (!map2D[currRow][currCol].isDetonated) {
-            map2D[currRow][currCol].isDetonated = true;
-        }
-        if (!map2D[currRow - 1][currCol].isDetonated) {
-            if (map2D[currRow - 1][currCol].isDiscovered) {
-                map2D[currRow - 1][currCol].sortBool = true;
-            }
-            tntPQ.push(&map2D[currRow - 1][currCol]);
-            map2D[currRow - 1][currCol].isDetonated = true;
-        }
-        if (!map2D[currRow + 1][currCol].isDetonated) {
-            if (map2D[currRow + 1][currCol].isDiscovered) {
-                map2D[currRow + 1][currCol].sortBool = true;
+
+    size_t exit = start;
+    uint64_t exitCost = UINT64_MAX;
+    for (size_t col = 0; col < size; ++col) {
+        for (size_t row = 0; row < size; ++row) {
+            bool onEdge = (row == 0 || row == size - 1 || col == 0 || col == size - 1);
+            if (onEdge && pathCost[row * size + col] < exitCost) {
+                exit = row * size + col;
+                exitCost = pathCost[exit];
             }
-            tntPQ.push(&map2D[currRow + 1][currCol]);
-            map2D[currRow + 1][currCol].isDetonated = true;
         }
-        if (!map2D[currRow][currCol - 1].isDetonated) {
-            if (map2D[currRow][currCol - 1].isDiscovered) {
-                map2D[currRow][currCol - 1].sortBool = true;
+    }
+
+    // A breadth first search over the steps that stay on a cheapest path finds the shortest one
+    constexpr uint32_t NOT_REACHED = UINT32_MAX;
+    BoardVector<uint32_t> cameFrom(size * size, NOT_REACHED);
+    vector<uint32_t> searchQueue { start };
+    cameFrom[start] = start;
+    for (size_t next = 0; next < searchQueue.size() && cameFrom[exit] == NOT_REACHED; ++next) {
+        uint32_t tile = searchQueue[next];
+        size_t row = tile / size;
+        size_t col = tile % size;
+        uint32_t neighbors[4] = {
+            row > 0 ? static_cast<uint32_t>(tile - size) : NOT_REACHED,          // Up
+            row < size - 1 ? static_cast<uint32_t>(tile + size) : NOT_REACHED,   // Down
+            col > 0 ? tile - 1 : NOT_REACHED,                                    // Left
+            col < size - 1 ? tile + 1 : NOT_REACHED,                             // Right
+        };
+        for (uint32_t neighbor : neighbors) {
+            if (neighbor != NOT_REACHED && cameFrom[neighbor] == NOT_REACHED
+                && pathCost[tile] + tileCost[neighbor] == pathCost[neighbor]) {
+                cameFrom[neighbor] = tile;
+                searchQueue.push_back(neighbor);
             }
-            tntPQ.push(&map2D[currRow][currCol - 1]);
-            map2D[currRow][currCol - 1].isDetonated = true;
         }
+    }
 
-        // Add any undiscovered tiles to the main PQ
-        if (!map2D[currRow - 1][currCol].isDiscovered) {   // Up
-            detonatedTiles.push_back(&map2D[currRow - 1][currCol]);
-            map2D[currRow - 1][currCol].isDiscovered = true;
-        }
-        if (!map2D[currRow + 1][currCol].isDiscovered) {   // Down
-            detonatedTiles.push_back(&map2D[currRow + 1][currCol]);
-            map2D[currRow + 1][currCol].isDiscovered = true;
-        }
-        if (!map2D[currRow][currCol - 1].isDiscovered) {   // Left
-            detonatedTiles.push_back(&map2D[currRow][currCol - 1]);
-            map2D[currRow][currCol - 1].isDiscovered = true;
+    escapePath.clear();
+    for (size_t tile = exit;; tile = cameFrom[tile]) {
+        escapePath.push_back(map2D[tile / size][tile % size]);
+        if (tile == start) {
+            break;
         }
     }
+    std::reverse(escapePath.begin(), escapePath.end());
+    escapeRubble = exitCost;
+}
 
-    // Tile is not on the edge
-    if (currRow != 0 && currRow != size - 1 && currCol != 0 && currCol != size - 1) {
-        if (!map2D[currRow][currCol].isDetonated) {
-            map2D[currRow][currCol].isDetonated = true;
-        }
-        if (!map2D[currRow - 1][currCol].isDetonated) {
-            if (map2D[currRow - 1][currCol].isDiscovered) {
-                map2D[currRow - 1][currCol].sortBool = true;
+// Writes the cheapest escape from every tile to costMapPath. Escapes cost the same both ways, so one
+// search outward from every edge tile at once finds them all
+void MineBoard::writeCostMap() {
+    vector<uint32_t> edgeTiles;
+    for (size_t row = 0; row < size; ++row) {
+        for (size_t col = 0; col < size; ++col) {
+            if (row == 0 || row == size - 1 || col == 0 || col == size - 1) {
+                edgeTiles.push_back(static_cast<uint32_t>(row * size + col));
             }
-            tntPQ.push(&map2D[currRow - 1][currCol]);
-            map2D[currRow - 1][currCol].isDetonated = true;
         }
-        if (!map2D[currRow + 1][currCol].isDetonated) {
-            if (map2D[currRow + 1][currCol].isDiscovered) {
-                map2D[currRow + 1][currCol].sortBool = true;
+    }
+    if (!findPathCosts(edgeTiles)) {
+        cerr << "Ran out of time before the cost map was done, " << costMapPath << " wasn't written\n";
+        return;
+    }
+    uint64_t maxCost = *std::max_element(pathCost.begin(), pathCost.end());
+
+    ofstream map(costMapPath, ios_base::binary | ios_base::trunc);
+    bool isImage = costMapPath.size() >= 4 && costMapPath.compare(costMapPath.size() - 4, 4, ".pgm") == 0;
+    vector<unsigned char> bytes;
+    if (isImage) {
+        // PGM pixels only go up to 65535, so bigger costs are scaled down. The real maximum is kept in
+        // a comment
+        uint64_t maxValue = std::max<uint64_t>(1, std::min<uint64_t>(maxCost, 65535));
+        map << "P5\n# Cheapest escape from every tile, the most is " << maxCost << "\n" << size << " " << size
+            << "\n" << maxValue << "\n";
+        size_t bytesPerPixel = maxValue > 255 ? 2 : 1;
+        bytes.resize(size * bytesPerPixel);
+        for (size_t row = 0; row < size && map; ++row) {
+            for (size_t col = 0; col < size; ++col) {
+                uint64_t cost = pathCost[row * size + col];
+                uint64_t pixel = maxCost > maxValue ? static_cast<uint64_t>(static_cast<double>(cost) * 65535.0
+                                                                            / static_cast<double>(maxCost))
+                                                    : cost;
+                // Pixels are big-endian
+                for (size_t byte = 0; byte < bytesPerPixel; ++byte) {
+                    bytes[col * bytesPerPixel + byte]
+                      = static_cast<unsigned char>(pixel >> (8 * (bytesPerPixel - 1 - byte)));
+                }
             }
-            tntPQ.push(&map2D[currRow + 1][currCol]);
-            map2D[currRow + 1][currCol].isDetonated = true;
+            map.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
         }
-        if (!map2D[currRow][currCol - 1].isDetonated) {
-            if (map2D[currRow][currCol - 1].isDiscovered) {
-                map2D[currRow][currCol - 1].sortBool = true;
+    } else {
+        uint32_t bytesPerCost = maxCost > UINT32_MAX ? 8 : 4;
+        auto putNumber = [&](uint64_t value, size_t numBytes) {
+            for (size_t byte = 0; byte < numBytes; ++byte) {
+                bytes.push_back(static_cast<unsigned char>(value >> (8 * byte)));
             }
-            tntPQ.push(&map2D[currRow][currCol - 1]);
-            map2D[currRow][currCol - 1].isDetonated = true;
-        }
-        if (!map2D[currRow][currCol + 1].isDetonated) {
-            if (map2D[currRow][currCol + 1].isDiscovered) {
-                map2D[currRow][currCol + 1].sortBool = true;
+        };
+        bytes.assign({ 'M', 'I', 'N', 'E', 'C', 'O', 'S', 'T' });
+        putNumber(size, 4);
+        putNumber(bytesPerCost, 4);
+        map.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        for (size_t row = 0; row < size && map; ++row) {
+            bytes.clear();
+            for (size_t col = 0; col < size; ++col) {
+                putNumber(pathCost[row * size + col], bytesPerCost);
             }
-            tntPQ.push(&map2D[currRow][currCol + 1]);
-            map2D[currRow][currCol + 1].isDetonated = true;
+            map.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
         }
+    }
 
-        // Add any undiscovered tiles to the main PQ
-        if (!map2D[currRow - 1][currCol].isDiscovered) {   // Up
-            detonatedTiles.push_back(&map2D[currRow - 1][currCol]);
-            map2D[currRow - 1][currCol].isDiscovered = true;
-        }
-        if (!map2D[currRow + 1][currCol].isDiscovered) {   // Down
-            detonatedTiles.push_back(&map2D[currRow + 1][currCol]);
-            map2D[currRow + 1][currCol].isDiscovered = true;
+    map.close();
+    if (!map) {
+        stop(1, "Could not write the cost map to " + costMapPath + "\n");
+    }
+}
+
+// A cache file for the current mine, the name is the mine's hash followed by the suffix
+string MineBoard::cachePath(const string& suffix) const {
+    ostringstream path;
+    path << cacheDir << '/' << std::hex << std::setw(16) << std::setfill('0') << boardKey << suffix;
+    return path.str();
+}
+
+// Files are written under a name no other run is using and renamed into place once they're complete
+static string tempSuffix() {
+    return ".tmp." + to_string(getpid()) + "." + to_string(std::hash<thread::id>()(this_thread::get_id()));
+}
+
+// Cached events are stored as four 32 bit numbers
+struct CachedEvent {
+    uint32_t type;
+    uint32_t row;
+    uint32_t col;
+    int32_t rubble;
+};
+
+// Passes output on to where it's going and keeps a copy in a file, the copy stops at the first write
+// that fails
+class CopyBuffer : public streambuf {
+public:
+    CopyBuffer(streambuf* destination, streambuf* copy) : destination(destination), copy(copy) {
+        setp(buffer, buffer + sizeof(buffer));
+    }
+
+    bool copied() const {
+        return copy != nullptr;
+    }
+
+protected:
+    int overflow(int c) override {
+        if (sync() != 0) {
+            return traits_type::eof();
         }
-        if (!map2D[currRow][currCol - 1].isDiscovered) {   // Left
-            detonatedTiles.push_back(&map2D[currRow][currCol - 1]);
-            map2D[currRow][currCol - 1].isDiscovered = true;
+        if (c != traits_type::eof()) {
+            *pptr() = static_cast<char>(c);
+            pbump(1);
         }
-        if (!map2D[currRow][currCol + 1].isDiscovered) {   // Right
-            detonatedTiles.push_back(&map2D[currRow][currCol + 1]);
-            map2D[currRow][currCol + 1].isDiscovered = true;
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+        std::streamsize length = pptr() - pbase();
+        if (copy != nullptr && copy->sputn(pbase(), length) != length) {
+            copy = nullptr;
         }
+        bool sent = destination->sputn(pbase(), length) == length;
+        setp(buffer, buffer + sizeof(buffer));
+        return sent ? 0 : -1;
     }
 
-    // Set current tnt tile to zero rubble because it has officially exploded
-    if (verboseMode) {
-        cout << "TNT explosion at [" << currRow << "," << currCol << "]!" << endl;
-        debugLineNum++;
+private:
+    streambuf* destination;
+    streambuf* copy;
+    char buffer[1 << 16];
+};
+
+// Sends the output for the current mine and flags from the cache, filling in whatever part isn't
+// cached yet
+void MineBoard::mineCached() {
+    string flags = string(verboseMode ? "v" : "") + (medianMode ? "m" : "")
+                   + (statsMode ? "s" + to_string(statsPrintNum) : "");
+    string outputPath = cachePath((flags.empty() ? "" : "-" + flags) + ".out");
+    int file = open(outputPath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat fileInfo;
+    if (file >= 0 && fstat(file, &fileInfo) == 0 && S_ISREG(fileInfo.st_mode)) {
+        sendCached(file);
+    } else {
+        renderCached(outputPath);
+    }
+    if (file >= 0) {
+        close(file);
+    }
+    if (eventsFile >= 0) {
+        close(eventsFile);
+        eventsFile = -1;
     }
-    statsTiles.push_back(map2D[currRow][currCol]);
-    map2D[currRow][currCol].rubble = 0;
+}
+
+// Prints the output and writes a copy into the cache, replaying the mine's events if they are there
+// and mining it otherwise. A pseudorandom mine with cached events was never made, so the output can't
+// be made again if writing the copy fails. The copy is only dropped then
+void MineBoard::renderCached(const string& outputPath) {
+    mkdir(cacheDir.c_str(), 0777);
+
+    // Runs that finish the same file at the same time each write their own copy, whichever is renamed
+    // last wins and they are the same anyway
+    string tempPath = outputPath + tempSuffix();
+    filebuf file;
+    bool caching = file.open(tempPath, ios_base::out | ios_base::binary | ios_base::trunc) != nullptr;
+    CopyBuffer copy(out.rdbuf(), caching ? &file : nullptr);
+    streambuf* destination = out.rdbuf(&copy);
+    if (boardCached) {
+        replayEvents();
+    } else {
+        saveEvents();
+    }
+    output();
+    out.flush();
+    out.rdbuf(destination);
 
-    if (tntPQ.empty()) {
+    if (!caching) {
         return;
     }
-    // If the next tile to blow up is tnt, call the function again
-    if (tntPQ.top()->rubble == -1) {
-        // Change the current tile to whichever has highest priority tnt
-        currRow = tntPQ.top()->rowNum;
-        currCol = tntPQ.top()->colNum;
+    bool written = copy.copied() && file.close() != nullptr;
+    if (!written || std::rename(tempPath.c_str(), outputPath.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+    }
+}
 
-        // Take the current tile out of the tnt PQ
-        tntPQ.pop();
+// Mines the board like mine(), also writing every event to the cache for runs with other flags
+void MineBoard::saveEvents() {
+    string eventsPath = cachePath(".events");
+    string tempPath = eventsPath + tempSuffix();
+    ofstream events(tempPath, ios_base::binary | ios_base::trunc);
+
+    startMining();
+    MineEvent event {};
+    while (nextEvent(event)) {
+        record(event);
+        CachedEvent cached { static_cast<uint32_t>(event.type), static_cast<uint32_t>(event.row),
+                             static_cast<uint32_t>(event.col), event.rubble };
+        events.write(reinterpret_cast<const char*>(&cached), sizeof(cached));
+    }
+    finishLoading();
 
-        detonate(tntPQ, detonatedTiles);
+    events.close();
+    if (!events || std::rename(tempPath.c_str(), eventsPath.c_str()) != 0) {
+        std::remove(tempPath.c_str());
     }
-    // All the tnt that could detonate did so just return
-    else {
+}
+
+// Counts and prints the cached events for the mine without having it in memory. The file was opened
+// when the mine was read in, so it can't go missing in between
+void MineBoard::replayEvents() {
+    auto replay = [this](const CachedEvent* events, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            record(MineEvent { static_cast<MineEvent::Type>(events[i].type), events[i].row, events[i].col,
+                               events[i].rubble });
+        }
+    };
+
+    struct stat fileInfo;
+    size_t length = fstat(eventsFile, &fileInfo) == 0 ? static_cast<size_t>(fileInfo.st_size) : 0;
+    void* mapped = length > 0 ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, eventsFile, 0) : MAP_FAILED;
+    if (mapped != MAP_FAILED) {
+        madvise(mapped, length, MADV_SEQUENTIAL);
+        replay(static_cast<const CachedEvent*>(mapped), length / sizeof(CachedEvent));
+        munmap(mapped, length);
+        return;
+    }
+
+    // Read it in blocks if it can't be mapped
+    CachedEvent block[4096];
+    ssize_t bytesRead;
+    while ((bytesRead = read(eventsFile, block, sizeof(block))) != 0) {
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        replay(block, static_cast<size_t>(bytesRead) / sizeof(CachedEvent));
+    }
+}
+
+// Copies a cached output file to the output, straight from the page cache when that's stdout
+void MineBoard::sendCached(int file) {
+    struct stat fileInfo;
+    if (fstat(file, &fileInfo) != 0 || fileInfo.st_size == 0) {
         return;
     }
+    size_t length = static_cast<size_t>(fileInfo.st_size);
+    out.flush();
+
+    off_t sent = 0;
+    if (out.rdbuf() == cout.rdbuf()) {
+        while (static_cast<size_t>(sent) < length) {
+            ssize_t count = sendfile(STDOUT_FILENO, file, &sent, length - static_cast<size_t>(sent));
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                break;
+            }
+        }
+    }
+
+    // Anything sendfile couldn't do, like output going to a socket buffer, gets written from a mapping
+    if (static_cast<size_t>(sent) < length) {
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapped == MAP_FAILED) {
+            return;
+        }
+        out.write(static_cast<const char*>(mapped) + sent, static_cast<std::streamsize>(length - static_cast<size_t>(sent)));
+        munmap(mapped, length);
+    }
 }
 
+#ifdef MINE_BENCHMARK
+// The benchmarks mine with a queue that records what happens to it
+template bool MineBoard::nextEventWith(TileGrid& grid, RecordingQueue& queue, MineEvent& event);
+#endif
+
 double MineBoard::getMedian() {
     double median;
     std::sort(rubbleValues.begin(), rubbleValues.end());
@@ -834,23 +3964,3 @@ double MineBoard::getMedian() {
 
     return median;
 }
-
-void MineBoard::sortQueue(priority_queue<Tile*, vector<Tile*>, TileCompare>& primaryPQ, size_t tileRowNum,
-                          size_t tileColNum) {
-    std::vector<Tile*> temp;
-
-    while (!primaryPQ.empty()) {
-        if (primaryPQ.top()->rowNum == tileRowNum && primaryPQ.top()->colNum == tileColNum) {
-            temp.push_back(primaryPQ.top());
-            primaryPQ.pop();
-            break;
-        }
-        temp.push_back(primaryPQ.top());
-        primaryPQ.pop();
-    }
-
-    // Re-insert elements into the priority queue
-    for (Tile* tile : temp) {
-        primaryPQ.push(tile);
-    }
-}
@@ -1,12 +1,69 @@
 // Project Identifier: 19034C8F3B1196BF8E0C6E1C0F973D2FD550B88F
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <queue>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 #include "getopt.h"
 using namespace std;
 
 
+// Memory for the mine and the other buffers that grow with it. Big blocks come from huge pages when
+// the system has them, and can be spread over every NUMA node or kept on the solving thread's node
+class BoardMemory {
+public:
+    enum NumaPolicy { NUMA_DEFAULT, NUMA_INTERLEAVE, NUMA_LOCAL };
+
+    static void setNumaPolicy(NumaPolicy policy);
+    static void* allocate(size_t bytes);
+    static void deallocate(void* memory, size_t bytes);
+
+private:
+    static atomic<int> numaPolicy;
+};
+
+template <typename T>
+struct BoardAllocator {
+    using value_type = T;
+
+    BoardAllocator() = default;
+    template <typename U>
+    BoardAllocator(const BoardAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(BoardMemory::allocate(count * sizeof(T)));
+    }
+    void deallocate(T* memory, size_t count) {
+        BoardMemory::deallocate(memory, count * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const BoardAllocator<T>&, const BoardAllocator<U>&) {
+    return true;
+}
+template <typename T, typename U>
+bool operator!=(const BoardAllocator<T>&, const BoardAllocator<U>&) {
+    return false;
+}
+
+template <typename T>
+using BoardVector = vector<T, BoardAllocator<T>>;
+
+
 struct Tile {
     size_t rowNum;
     size_t colNum;
@@ -14,7 +71,7 @@ struct Tile {
     bool isDiscovered = false;
     bool isDetonated = false;
     bool isTNT = false;
-    bool sortBool = false;
+    uint8_t blastRadius = 1;   // How far this TNT reaches when every TNT tile has its own strength
 };
 
 struct TileCompare {
@@ -41,13 +98,384 @@ struct StatsEasyCompare {
         }
         return a.rowNum < b.rowNum;
     }
-} EasyCompare;
+};
+
+inline StatsEasyCompare EasyCompare;
+
+// Mines up to this size get a solver with the row length and queue capacity fixed at compile time
+constexpr size_t SMALL_MINE_SIZE = 64;
+
+// What TNT blows up: a cross is every tile within the radius counting steps up, down, left and right,
+// a square also counts diagonal steps. The default cross of radius 1 is the 4 tiles next to the TNT
+enum BlastShape { BLAST_CROSS, BLAST_SQUARE };
+constexpr size_t MAX_BLAST_RADIUS = 3;
+struct BlastStencil;
+
+// Min-heap of tiles packed into 64 bit keys that sort exactly like TileCompare: rubble in the top half
+// (plus one so TNT is zero), then the column, then the row. Comparing keys never touches the board.
+// The heap remembers where every tile is so a tile's key can be changed when TNT clears it.
+// MaxSize 0 grows with the board, otherwise everything sits in fixed arrays for mines up to MaxSize
+template <size_t MaxSize>
+class BasicTileQueue {
+public:
+    static uint64_t key(int rubble, size_t row, size_t col) {
+        return (static_cast<uint64_t>(rubble + 1) << 32) | (static_cast<uint64_t>(col) << 16) | row;
+    }
+    static uint64_t key(const Tile& tile) {
+        return key(tile.rubble, tile.rowNum, tile.colNum);
+    }
+    static size_t row(uint64_t key) {
+        return static_cast<size_t>(key & 0xFFFF);
+    }
+    static size_t col(uint64_t key) {
+        return static_cast<size_t>((key >> 16) & 0xFFFF);
+    }
+
+    // Coordinates get 16 bits each
+    static constexpr size_t MAX_SIZE = 1 << 16;
+
+    // Empties the queue for a board of the given size
+    void reset(size_t boardSize) {
+        count = 0;
+        if constexpr (MaxSize == 0) {
+            stride = boardSize;
+            positions.assign(stride * stride, NOT_QUEUED);
+        } else {
+            positions.fill(NOT_QUEUED);
+        }
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    uint64_t top() const {
+        return heap[0];
+    }
+
+    bool contains(size_t row, size_t col) const {
+        return positions[row * stride + col] != NOT_QUEUED;
+    }
+
+    void push(uint64_t key) {
+        if constexpr (MaxSize == 0) {
+            if (count == heap.size()) {
+                heap.push_back(key);
+            }
+        }
+        siftUp(count++, key);
+    }
+
+    void pop() {
+        positions[index(heap[0])] = NOT_QUEUED;
+        uint64_t last = heap[--count];
+        if (count > 0) {
+            siftDown(0, last);
+        }
+    }
+
+    // Gives a tile that is already queued its new key after its rubble changed
+    void update(uint64_t key) {
+        size_t position = positions[index(key)];
+        if (key < heap[position]) {
+            siftUp(position, key);
+        } else {
+            siftDown(position, key);
+        }
+    }
+
+private:
+    // Positions are small enough for 16 bits when the whole board fits in a fixed array
+    using Position = conditional_t<MaxSize != 0 && MaxSize * MaxSize <= UINT16_MAX, uint16_t, uint32_t>;
+    static constexpr Position NOT_QUEUED = numeric_limits<Position>::max();
+
+    conditional_t<MaxSize == 0, BoardVector<uint64_t>, array<uint64_t, MaxSize * MaxSize>> heap;
+    // Where each tile is in the heap, indexed by row * stride + col
+    conditional_t<MaxSize == 0, BoardVector<Position>, array<Position, MaxSize * MaxSize>> positions;
+    size_t count = 0;
+    size_t stride = MaxSize;
+
+    size_t index(uint64_t key) const {
+        return row(key) * stride + col(key);
+    }
+
+    void place(size_t position, uint64_t key) {
+        heap[position] = key;
+        positions[index(key)] = static_cast<Position>(position);
+    }
+
+    void siftUp(size_t position, uint64_t key) {
+        while (position > 0 && key < heap[(position - 1) / 2]) {
+            place(position, heap[(position - 1) / 2]);
+            position = (position - 1) / 2;
+        }
+        place(position, key);
+    }
+
+    void siftDown(size_t position, uint64_t key) {
+        while (2 * position + 1 < count) {
+            size_t child = 2 * position + 1;
+            if (child + 1 < count && heap[child + 1] < heap[child]) {
+                child++;
+            }
+            if (heap[child] >= key) {
+                break;
+            }
+            place(position, heap[child]);
+            position = child;
+        }
+        place(position, key);
+    }
+};
+
+using TileQueue = BasicTileQueue<0>;
+
+#ifdef MINE_BENCHMARK
+// A TileQueue that writes down everything done to it, so the benchmarks can replay the same pattern
+// of pushes, pops and updates a real run makes
+class RecordingQueue {
+public:
+    static constexpr uint64_t POP = uint64_t(1) << 63;
+    static constexpr uint64_t UPDATE = uint64_t(1) << 62;
+
+    explicit RecordingQueue(vector<uint64_t>& operations) : log(operations) {}
+
+    void reset(size_t boardSize) {
+        queue.reset(boardSize);
+    }
+    bool empty() const {
+        return queue.empty();
+    }
+    uint64_t top() const {
+        return queue.top();
+    }
+    bool contains(size_t row, size_t col) const {
+        return queue.contains(row, col);
+    }
+    void push(uint64_t key) {
+        log.push_back(key);
+        queue.push(key);
+    }
+    void pop() {
+        log.push_back(POP);
+        queue.pop();
+    }
+    void update(uint64_t key) {
+        log.push_back(key | UPDATE);
+        queue.update(key);
+    }
+
+private:
+    TileQueue queue;
+    vector<uint64_t>& log;
+};
+#endif
+
+// One thing that happens while mining, handed out one at a time by MineBoard::nextEvent()
+struct MineEvent {
+    enum Type { CLEARED, TNT_EXPLOSION, CLEARED_BY_TNT };
+
+    Type type;
+    size_t row;
+    size_t col;
+    int rubble;   // What was on the tile, -1 for TNT
+};
+
+// How far mining has got, published every so often with relaxed stores so another thread can report
+// it without slowing the miner down
+struct MineProgress {
+    atomic<uint64_t> tilesCleared { 0 };
+    atomic<uint64_t> rubbleCleared { 0 };
+    atomic<uint64_t> frontier { 0 };   // Tiles queued up to be cleared
+    atomic<uint32_t> row { 0 };
+    atomic<uint32_t> col { 0 };
+    atomic<bool> mining { false };
+};
+
+// One of the miners in a run with --miners. Its frontier is a heap of TileQueue keys that can hold
+// stale keys, a tile whose rubble changes after it's queued is pushed again with its new key
+struct Miner {
+    size_t startRow = 0;
+    size_t startCol = 0;
+    size_t row = 0;
+    size_t col = 0;
+    priority_queue<uint64_t, vector<uint64_t>, std::greater<uint64_t>> frontier;
+    vector<uint32_t> claims;   // Tiles next to it that it tried to claim this round
+    bool active = true;
+    bool escaped = false;
+    bool onTNT = false;   // Stepped on TNT this round, it goes off once every miner has moved
+    // Rows and columns that every tile it has claimed lies within
+    size_t top = 0;
+    size_t bottom = 0;
+    size_t left = 0;
+    size_t right = 0;
+    size_t tilesCleared = 0;
+    uint64_t rubbleCleared = 0;
+    ostringstream events;   // What it prints with -v
+};
+
+// How many of some kind of tile are in any rectangle of the mine, as they get taken away one at a
+// time. A 2D Fenwick tree, so both take a couple of hundred steps even on the biggest mines
+class TileCounts {
+public:
+    // Counts every tile isCounted picks out, building the tree a row and then a column at a time
+    template <typename IsCounted>
+    void assign(size_t mineSize, IsCounted isCounted) {
+        size = mineSize;
+        tree.assign((size + 1) * (size + 1), 0);
+        for (size_t row = 0; row < size; ++row) {
+            for (size_t col = 0; col < size; ++col) {
+                tree[(row + 1) * (size + 1) + col + 1] = isCounted(row, col) ? 1 : 0;
+            }
+        }
+        for (size_t row = 1; row <= size; ++row) {
+            for (size_t col = 1; col <= size; ++col) {
+                size_t parent = col + (col & (~col + 1));
+                if (parent <= size) {
+                    tree[row * (size + 1) + parent] += tree[row * (size + 1) + col];
+                }
+            }
+        }
+        for (size_t col = 1; col <= size; ++col) {
+            for (size_t row = 1; row <= size; ++row) {
+                size_t parent = row + (row & (~row + 1));
+                if (parent <= size) {
+                    tree[parent * (size + 1) + col] += tree[row * (size + 1) + col];
+                }
+            }
+        }
+    }
+
+    void remove(size_t row, size_t col) {
+        for (size_t i = row + 1; i <= size; i += i & (~i + 1)) {
+            for (size_t j = col + 1; j <= size; j += j & (~j + 1)) {
+                tree[i * (size + 1) + j]--;
+            }
+        }
+    }
+
+    // Tiles from [top,left] to [bottom,right], both corners included
+    uint32_t count(size_t top, size_t left, size_t bottom, size_t right) const {
+        return before(bottom + 1, right + 1) - before(top, right + 1) - before(bottom + 1, left) + before(top, left);
+    }
+
+private:
+    // Tiles in the rows above row and the columns left of col
+    uint32_t before(size_t row, size_t col) const {
+        uint32_t total = 0;
+        for (size_t i = row; i > 0; i -= i & (~i + 1)) {
+            for (size_t j = col; j > 0; j -= j & (~j + 1)) {
+                total += tree[i * (size + 1) + j];
+            }
+        }
+        return total;
+    }
+
+    size_t size = 0;
+    BoardVector<uint32_t> tree;
+};
+
+class SocketBuffer;
+class DecodeBuffer;
+
+// Thrown to end a request early when running as a server, instead of exiting
+struct RunStopped {
+    int status;
+    string message;
+};
+
+// Thrown out of waitForRow() when the deadline passes while the miner is waiting for a row to load
+struct DeadlinePassed {};
+
+// The whole mine in one block, row after row, so map2D[row][col] works like it did with a vector of rows.
+// Small mines leave room at the end of each row so their rows are as long as their fixed size solver expects
+class TileGrid {
+public:
+    // Every tile goes back to default, the block is only reallocated if the mine got bigger
+    void assign(size_t size, size_t rowLength) {
+        width = rowLength;
+        tiles.assign(size * width, Tile());
+    }
+
+    Tile* operator[](size_t row) {
+        return tiles.data() + row * width;
+    }
+    const Tile* operator[](size_t row) const {
+        return tiles.data() + row * width;
+    }
+
+    Tile* data() {
+        return tiles.data();
+    }
+
+    // How far the tiles up, down, left and right of a tile are from it
+    array<ptrdiff_t, 4> neighbors() const {
+        return { -static_cast<ptrdiff_t>(width), static_cast<ptrdiff_t>(width), -1, 1 };
+    }
+    ptrdiff_t offset(ptrdiff_t rows, ptrdiff_t cols) const {
+        return rows * static_cast<ptrdiff_t>(width) + cols;
+    }
+
+private:
+    BoardVector<Tile> tiles;
+    size_t width = 0;
+};
+
+// The same tiles as a TileGrid whose rows are N long, known at compile time, so the neighbors of a
+// tile are a table of constants
+template <size_t N>
+class FixedGrid {
+public:
+    explicit FixedGrid(TileGrid& grid) : tiles(grid.data()) {}
+
+    Tile* operator[](size_t row) const {
+        return tiles + row * N;
+    }
+
+    static constexpr array<ptrdiff_t, 4> NEIGHBORS = { -static_cast<ptrdiff_t>(N), static_cast<ptrdiff_t>(N), -1, 1 };
+    static constexpr const array<ptrdiff_t, 4>& neighbors() {
+        return NEIGHBORS;
+    }
+    static constexpr ptrdiff_t offset(ptrdiff_t rows, ptrdiff_t cols) {
+        return rows * static_cast<ptrdiff_t>(N) + cols;
+    }
+
+private:
+    Tile* tiles;
+};
 
 class MineBoard {
 private:
-    vector<vector<Tile>> map2D;
+    friend struct MineBench;
+
+    istream in { cin.rdbuf() };
+    ostream out { cout.rdbuf() };
+    TileGrid map2D;
     vector<Tile> statsTiles;
-    vector<int> rubbleValues;
+    BoardVector<int> rubbleValues;
+    // TNT tiles that touch each other form a component that always detonates together. The rubble
+    // around component c is perimeterTiles[perimeterStart[c]] up to perimeterTiles[perimeterStart[c + 1]]
+    BoardVector<uint32_t> componentOf;   // Component id of every TNT tile, indexed by row * size + col
+    vector<size_t> perimeterStart;
+    BoardVector<Tile*> perimeterTiles;
+    vector<Tile*> blastTiles;   // Rubble hit by the current chain when the perimeters weren't precomputed
+    TileQueue primaryPQ;
+    BasicTileQueue<SMALL_MINE_SIZE> smallPQ;
+    priority_queue<uint64_t, vector<uint64_t>, std::greater<uint64_t>> chainPQ;   // Only TNT goes in here
+    // Pipelined loading, the board is filled in by the loader thread while the miner runs
+    thread loader;
+    vector<char> inputText;
+    atomic<size_t> rowsLoaded { 0 };
+    atomic<bool> stopLoading { false };
+    string loadError;   // The first mistake the loader found in the mine, guarded by loadMutex
+    mutex loadMutex;
+    condition_variable rowLoaded;
+    unique_ptr<DecodeBuffer> decoder;   // Set while the input is compressed
+    size_t numTNT = 0;
     size_t currRow = 0;
     size_t currCol = 0;
     size_t size = 0;
@@ -55,18 +483,154 @@ private:
     int debugLineNum = 1;
     int tilesCleared = 0;
     int rubbleCleared = 0;
+    int tntExplosions = 0;
     bool verboseMode = false;
     bool medianMode = false;
     bool statsMode = false;
+    bool pipelineMode = false;
+    bool hwCounters = false;   // Only for a run from the command line, it's per process
+    // Time budget, solving stops early once it's passed. It starts when solving does, so reading the
+    // mine doesn't use it up
+    bool hasDeadline = false;
+    std::chrono::milliseconds deadlineBudget { 0 };
+    bool deadlineStarted = false;
+    std::chrono::steady_clock::time_point deadline;
+    bool timedOut = false;
+    BlastShape blastShape = BLAST_CROSS;
+    size_t blastRadius = 1;
+    bool blastPerTile = false;   // Each TNT tile's own blastRadius is used instead
+    int progressInterval = -1;   // Milliseconds between progress lines, 0 for only on SIGUSR1, -1 for none
+    MineProgress progress;
+    // Where the miner is up to, so mining can stop after any event and pick up again later
+    enum MinePhase { MINE_START, MINE_MOVE, MINE_EXPLODE, MINE_CLEAR_BLAST, MINE_ESCAPE, MINE_DONE };
+    MinePhase phase = MINE_DONE;
+    vector<Tile*> detonatedTiles;   // Found by the current chain, they go in the queue once it's done
+    Tile** blastNext = nullptr;     // Rubble the current chain still has to clear
+    Tile** blastEnd = nullptr;
+    bool sortBlasts = false;
+    bool chainEscapes = false;      // The chain went off on the edge, so mining is over once it's cleared
+    // After TNT goes off the tile it started from stays queued, so the next pop is skipped
+    bool skipPop = false;
+    // Server mode, where the board is reused for request after request
+    string socketPath;
+    size_t numWorkers = 0;
+    bool serverMode = false;
+    // The cheapest escape, through the least rubble of any path from the start to the edge. TNT counts
+    // as no rubble
+    bool optimalMode = false;
+    BoardVector<uint32_t> tileCost;   // Rubble on every tile, indexed by row * size + col
+    BoardVector<uint64_t> pathCost;   // Least rubble on any path from the sources to every tile
+    vector<Tile> escapePath;
+    uint64_t escapeRubble = 0;
+    bool escapeFound = false;   // False if the deadline passed before the search was done
+    string costMapPath;   // Where to write the cheapest escape from every tile, if anywhere
+    string transcriptPath;   // Output of an earlier run to check instead of printing this one
+    ifstream transcript;
+    // More miners mining the same board at once, each tile belongs to whichever claimed it first
+    vector<pair<size_t, size_t>> minerStarts;   // Where every miner but the first starts
+    vector<Miner> miners;
+    BoardVector<uint32_t> claimedBy;   // Miner each tile belongs to, indexed by row * size + col
+    BoardVector<uint32_t> claimRound;   // Round each tile was first claimed in
+    TileCounts liveTNT;   // TNT that hasn't gone off yet
+    // Sweep mode, which solves lots of pseudorandom mines in memory and only prints statistics
+    string sweepRanges;
+    bool sweepRuns = false;
+    // Result cache. A mine's events and the output for each set of flags are kept in files named after
+    // a hash of the mine
+    string cacheDir;
+    uint64_t boardKey = 0;
+    bool boardCached = false;   // The mine's events are already cached, so it was never generated
+    int eventsFile = -1;
 
 public:
-    MineBoard() = default;
+    MineBoard();
+    ~MineBoard();
+    void reset(streambuf* input, streambuf* output);
+    [[noreturn]] void stop(int status, const string& message);
+    bool isServer() const {
+        return !socketPath.empty();
+    }
+    void serve();
+    bool isSweep() const {
+        return !sweepRanges.empty();
+    }
+    void sweep();
+    bool usesHwCounters() const {
+        return hwCounters;
+    }
+    int getProgressInterval() const {
+        return progressInterval;
+    }
+    const MineProgress& getProgress() const {
+        return progress;
+    }
+    void publishProgress(const MineEvent& event);
+    void publishMinersProgress();
+    void solveRandom(uint32_t mineSize, uint32_t seed, uint32_t maxRubble, uint32_t tntChance);
+    void handleRequest(int client, string& request);
+    void sendStopped(int client, SocketBuffer& reply, const RunStopped& stopped);
     void printHelp(char* argv[]);
     void getOptions(int argc, char* argv[]);
-    vector<vector<Tile>> readInput();
+    void parseOptions(int argc, char* argv[]);
+    void readInput();
+    void loadRows(istream& inputStream);
+    void generateRows(uint32_t seed, uint32_t maxRubble, uint32_t tntChance);
+    void parseGrid();
+    void parseDecoded();
+    void checkDecoded();
+    string parseChunk(const char* pos, const char* end, size_t firstValue, size_t line, size_t& tntFound);
+    void waitForRow(size_t row);
+    void startDeadline();
+    bool pastDeadline() const;
+    void finishLoading();
     void output();
+    void outputStats();
+    void outputCheapestEscape();
     void mine();
-    void detonate(priority_queue<Tile*, vector<Tile*>, TileCompare>& tntPQ, vector<Tile*>& detonatedTiles);
+    void startMining();
+    bool nextEvent(MineEvent& event);
+    template <typename Grid, typename Queue>
+    bool nextEventWith(Grid& grid, Queue& queue, MineEvent& event);
+    void startChain(bool escaping);
+    void record(const MineEvent& event);
+    // A run cut short by its deadline can't be cached, so runs with one don't use the cache at all.
+    // Neither do runs that search for cheapest escapes, a cache hit never loads the mine, or runs that
+    // check a transcript or have more than one miner
+    bool usesCache() const {
+        return !cacheDir.empty() && !hasDeadline && !optimalMode && costMapPath.empty() && !isValidating()
+               && !hasMiners();
+    }
+    bool isValidating() const {
+        return !transcriptPath.empty();
+    }
+    bool validate();
+    string explainEvent(const MineEvent& expected, const MineEvent& claimed);
+    bool hasMiners() const {
+        return !minerStarts.empty();
+    }
+    void mineTogether();
+    void moveMiner(size_t index, uint32_t round);
+    void claimTiles(size_t index);
+    size_t roundsApart() const;
+    void detonateFor(size_t index, uint32_t round);
+    void requeueTile(const Tile& tile);
+    void recordFor(Miner& miner, const MineEvent& event);
+    void outputMiners();
+    string cachePath(const string& suffix) const;
+    void mineCached();
+    void renderCached(const string& outputPath);
+    void saveEvents();
+    void replayEvents();
+    void sendCached(int file);
+    const BlastStencil& blastStencil(const Tile& tnt) const;
+    // The TNT chains can only be found up front when every TNT blasts the same way. Small mines don't
+    // bother
+    bool findsChainsUpFront() const {
+        return size > SMALL_MINE_SIZE && !blastPerTile;
+    }
+    void findTNTComponents();
+    bool findPathCosts(const vector<uint32_t>& sources);
+    void findCheapestEscape();
+    void writeCostMap();
     double getMedian();
-    void sortQueue(priority_queue<Tile*, vector<Tile*>, TileCompare>& primaryPQ, size_t tileRowNum, size_t tileColNum);
 };